@@ -5,6 +5,7 @@ echo "installing WebAssembly files"
 
 cp ./build/mo_simulator_wasm.mjs ./webapp-src/src/
 cp ./build/mo_simulator_wasm.wasm ./webapp-src/public/
+cp ./build-webapp/mo_sim_worker.mjs ./webapp-src/src/
 
 if [ -e ./webapp-src/src/DataService_wasm.js.template ]
 then
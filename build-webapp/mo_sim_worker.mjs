@@ -0,0 +1,66 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+// Web Worker which runs one Simulator instance off the UI thread. Each instance is one
+// charge point with its own OCPP context, so a multi-charger site starts one worker per
+// charge point:
+//
+//     const worker = new Worker(new URL('./mo_sim_worker.mjs', import.meta.url), {type: 'module'});
+//     worker.postMessage({init: {backendUrl: 'wss://...', chargeBoxId: 'charger-02'}});
+//     worker.postMessage(new Int32Array([5, 1, 0])); // MO_WASM_CMD_PLUGIN at connector 1
+//
+// Messages to the worker:
+//     Int32Array [command, connectorId, value]   compact command, see WasmCommand in net_wasm.h
+//     {init: {backendUrl, chargeBoxId, authorizationKey}}
+//     {id, endpoint, method, body}               API call, answered with {id, response}
+//     {state: true}                              answered with {state: ArrayBuffer} which holds a
+//                                                copy of WasmSimState (see net_wasm.h)
+// Messages from the worker:
+//     {ready: true}                              Simulator is set up
+//     {id, response}                             response body or null on error
+//     {command, connectorId, error: true}        rejected compact command
+
+import createModule from './mo_simulator_wasm.mjs';
+
+let module = null;
+let apiCall = null;
+let command = null;
+let statePtr = 0;
+const queue = []; // messages which arrived before the module was ready
+
+function handle(msg) {
+    if (msg instanceof Int32Array) {
+        if (command(msg[0], msg[1], msg[2]) < 0) {
+            postMessage({command: msg[0], connectorId: msg[1], error: true});
+        }
+    } else if (msg.init) {
+        apiCall('/websocket', 'POST', JSON.stringify(msg.init));
+    } else if (msg.state) {
+        // connectorStateSize * numConnectors + 5 header fields
+        const header = new Uint32Array(module.HEAPU8.buffer, statePtr, 5);
+        const size = 20 + header[3] * header[4];
+        const state = module.HEAPU8.slice(statePtr, statePtr + size).buffer;
+        postMessage({state: state}, [state]);
+    } else if (msg.endpoint) {
+        const response = apiCall(msg.endpoint, msg.method || 'GET', msg.body || '');
+        postMessage({id: msg.id, response: response});
+    }
+}
+
+onmessage = (e) => {
+    if (module) {
+        handle(e.data);
+    } else {
+        queue.push(e.data);
+    }
+};
+
+createModule().then((m) => {
+    module = m;
+    apiCall = m.cwrap('mocpp_wasm_api_call', 'string', ['string', 'string', 'string']);
+    command = m.cwrap('mocpp_wasm_command', 'number', ['number', 'number', 'number']);
+    statePtr = m.ccall('mocpp_wasm_state', 'number', [], []);
+    queue.splice(0).forEach(handle);
+    postMessage({ready: true});
+});
@@ -0,0 +1,69 @@
+#launch a fleet of Simulator processes with a mix of OCPP 1.6 and 2.0.1 chargers
+#
+#usage: ./launch_fleet.sh <count> <percentage of 2.0.1 chargers> <backend url> [base port] [id prefix]
+#example: ./launch_fleet.sh 10 30 ws://localhost:8180/steve/websocket/CentralSystemService/
+#
+#Every charger runs in its own working directory fleet/charger-<i> with its own mo_store, and
+#serves its API on <base port> + <i>. Stop the fleet with Ctrl+C
+
+#exit script on error
+set -e
+
+if [ $# -lt 3 ]
+then
+   echo "usage: $0 <count> <percentage of 2.0.1 chargers> <backend url> [base port] [id prefix]"
+   exit 1
+fi
+
+COUNT=$1
+SHARE_201=$2
+BACKEND=$3
+BASE_PORT=${4:-8000}
+ID_PREFIX=${5:-mo-sim-}
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+SIMULATOR="$ROOT/build/mo_simulator"
+
+#check the Simulator is built
+if [ ! -x "$SIMULATOR" ]
+then
+   echo "no Simulator executable found at $SIMULATOR. Build the target mo_simulator first"
+   exit 1
+fi
+
+PIDS=""
+
+stop_fleet() {
+   echo "Stopping fleet..."
+   kill $PIDS 2>/dev/null || true
+   wait
+   exit 0
+}
+
+trap stop_fleet INT TERM
+
+for i in $(seq 0 $((COUNT - 1)))
+do
+   #spread the 2.0.1 chargers evenly over the fleet
+   if [ $(( (i + 1) * SHARE_201 / 100 )) -gt $(( i * SHARE_201 / 100 )) ]
+   then
+      VERSION=2.0.1
+   else
+      VERSION=1.6
+   fi
+
+   DIR="$ROOT/fleet/charger-$i"
+   mkdir -p "$DIR/mo_store"
+   ln -sfn "$ROOT/public" "$DIR/public"
+
+   PORT=$((BASE_PORT + i))
+   ID="$ID_PREFIX$i"
+
+   (cd "$DIR" && exec "$SIMULATOR" --ocpp $VERSION --id "$ID" --backend "$BACKEND" --api "http://0.0.0.0:$PORT" > simulator.log 2>&1) &
+   PIDS="$PIDS $!"
+
+   echo "$ID: OCPP $VERSION, API on port $PORT, log in $DIR/simulator.log"
+done
+
+echo "Fleet of $COUNT chargers is running. Press Ctrl+C to stop"
+wait
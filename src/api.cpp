@@ -11,6 +11,18 @@
 #include <MicroOcpp/Model/Authorization/IdToken.h>
 
 #include "evse.h"
+#include "offline.h"
+#include "startup.h"
+#include "site.h"
+#include "faults.h"
+#include "impair.h"
+#include "profile.h"
+#include "logger.h"
+#include "history.h"
+#include "tokens.h"
+#include "localauth.h"
+#include "throughput.h"
+#include "reboot.h"
 
 //simple matching function; takes * as a wildcard
 bool str_match(const char *query, const char *pattern) {
@@ -31,8 +43,56 @@ bool str_match(const char *query, const char *pattern) {
     return !query[qi] && !pattern[pi];
 }
 
+//parses a decimal number like "0.05" from a query parameter
+bool mg_str_to_float(struct mg_str str, float& out) {
+    char buf [32];
+    if (!str.buf || str.len == 0 || str.len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, str.buf, str.len);
+    buf[str.len] = '\0';
+    char *end = nullptr;
+    out = strtof(buf, &end);
+    return end == buf + str.len;
+}
+
+//the EVSE state of the API follows the EVSE events. Clients compare stateRevision to skip unchanged EVSEs
+struct EvseStateView {
+    unsigned long revision = 0;
+    const char *lastEvent = "";
+};
+static std::array<EvseStateView, MO_NUMCONNECTORS - 1> evseStateViews;
+static bool evseStateSubscribed = false;
+
+static const char *evseEventName(EvseEvent event) {
+    switch (event) {
+        case EvseEvent::StatusChanged:
+            return "StatusChanged";
+        case EvseEvent::InputsChanged:
+            return "InputsChanged";
+        case EvseEvent::ChargingStarted:
+            return "ChargingStarted";
+        case EvseEvent::ChargingStopped:
+            return "ChargingStopped";
+    }
+    return "";
+}
+
+void api_subscribe_events() {
+    if (evseStateSubscribed) {
+        return; //the connectors outlive the reboots, so their listeners are kept
+    }
+    for (unsigned int i = 0; i < connectors.size(); i++) {
+        connectors[i].addListener([i] (Evse&, EvseEvent event) {
+            evseStateViews[i].revision++;
+            evseStateViews[i].lastEvent = evseEventName(event);
+        });
+    }
+    evseStateSubscribed = true;
+}
+
 int mocpp_api_call(const char *endpoint, MicroOcpp::Method method, const char *body, char *resp_body, size_t resp_body_size) {
-    
+
     MO_DBG_VERBOSE("process %s, %s: %s",
             endpoint,
             method == MicroOcpp::Method::GET ? "GET" :
@@ -56,12 +116,8 @@ int mocpp_api_call(const char *endpoint, MicroOcpp::Method method, const char *b
     
     unsigned int connectorId = 0;
 
-    if (strlen(endpoint) >= 11) {
-        if (endpoint[11] == '1') {
-            connectorId = 1;
-        } else if (endpoint[11] == '2') {
-            connectorId = 2;
-        }
+    if (!strncmp(endpoint, "/connector/", strlen("/connector/"))) {
+        connectorId = (unsigned int) strtoul(endpoint + strlen("/connector/"), nullptr, 10);
     }
 
     MO_DBG_VERBOSE("connectorId = %u", connectorId);
@@ -74,9 +130,23 @@ int mocpp_api_call(const char *endpoint, MicroOcpp::Method method, const char *b
     //start different api endpoints
     if(str_match(endpoint, "/connectors")) {
         MO_DBG_VERBOSE("query connectors");
-        response.add("1");
-        response.add("2");
-        status = 200;
+        //serialize directly, the fixed-size response document doesn't scale with the number of EVSEs
+        int written = snprintf(resp_body, resp_body_size, "[");
+        for (size_t i = 0; i < connectors.size(); i++) {
+            if (written < 0 || (size_t) written >= resp_body_size) {
+                return 500;
+            }
+            written += snprintf(resp_body + written, resp_body_size - written, "%s\"%u\"",
+                    i ? "," : "", connectors[i].getConnectorId());
+        }
+        if (written < 0 || (size_t) written >= resp_body_size) {
+            return 500;
+        }
+        written += snprintf(resp_body + written, resp_body_size - written, "]");
+        if (written < 0 || (size_t) written >= resp_body_size) {
+            return 500;
+        }
+        return 200;
     } else if(str_match(endpoint, "/connector/*/evse")){
         MO_DBG_VERBOSE("query evse");
         if (!evse) {
@@ -103,6 +173,9 @@ int mocpp_api_call(const char *endpoint, MicroOcpp::Method method, const char *b
         response["evReady"] = evse->getEvReady();
         response["evseReady"] = evse->getEvseReady();
         response["chargePointStatus"] = evse->getOcppStatus();
+        response["charging"] = evse->isCharging();
+        response["stateRevision"] = evseStateViews[connectorId-1].revision;
+        response["lastEvent"] = evseStateViews[connectorId-1].lastEvent;
         status = 200;
     } else if(str_match(endpoint, "/connector/*/meter")){
         MO_DBG_VERBOSE("query meter");
@@ -163,7 +236,7 @@ int mocpp_api_call(const char *endpoint, MicroOcpp::Method method, const char *b
 int mocpp_api2_call(const char *uri_raw, size_t uri_raw_len, MicroOcpp::Method method, const char *query_raw, size_t query_raw_len, char *resp_body, size_t resp_body_size) {
 
     snprintf(resp_body, resp_body_size, "%s", "");
-    
+
     struct mg_str uri = mg_str_n(uri_raw, uri_raw_len);
     struct mg_str query = mg_str_n(query_raw, query_raw_len);
 
@@ -173,8 +246,8 @@ int mocpp_api2_call(const char *uri_raw, size_t uri_raw_len, MicroOcpp::Method m
     unsigned int num;
     struct mg_str evse_id_str = mg_http_var(query, mg_str("evse_id"));
     if (evse_id_str.buf) {
-        if (!mg_str_to_num(evse_id_str, 10, &num, sizeof(num)) || num < 1 || num >= MO_NUM_EVSEID) {
-            snprintf(resp_body, resp_body_size, "invalid connector_id");
+        if (!mg_str_to_num(evse_id_str, 10, &num, sizeof(num)) || num < 1 || num > connectors.size()) {
+            snprintf(resp_body, resp_body_size, "invalid evse_id");
             return 400;
         }
         evse_id = (int)num;
@@ -182,8 +255,9 @@ int mocpp_api2_call(const char *uri_raw, size_t uri_raw_len, MicroOcpp::Method m
 
     struct mg_str connector_id_str = mg_http_var(query, mg_str("connector_id"));
     if (connector_id_str.buf) {
+        //MicroOcpp models one connector per EVSE, so only the number of EVSEs is configurable
         if (!mg_str_to_num(connector_id_str, 10, &num, sizeof(num)) || num != 1) {
-            snprintf(resp_body, resp_body_size, "invalid connector_id");
+            snprintf(resp_body, resp_body_size, "invalid connector_id, each EVSE has only connector 1");
             return 400;
         }
         connector_id = (int)num;
@@ -304,6 +378,567 @@ int mocpp_api2_call(const char *uri_raw, size_t uri_raw_len, MicroOcpp::Method m
                 trackAuthActive && authActive ?  "no action taken (EVSE still authorized)" : 
                                                  "no action taken (EVSE not authorized)");
 
+        return 200;
+    } else if (mg_match(uri, mg_str("/startup"), NULL)) {
+        if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+        int ret = snprintf(resp_body, resp_body_size,
+                "{\"storageLoaded\":%lu,\"initialized\":%lu,\"bootNotification\":%lu}",
+                startupStats.storageLoaded, startupStats.initialized, startupStats.bootNotification);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/offline"), NULL)) {
+        if (method == MicroOcpp::Method::POST) {
+            struct mg_str duration_str = mg_http_var(query, mg_str("duration"));
+            if (!duration_str.buf || !mg_str_to_num(duration_str, 10, &num, sizeof(num))) {
+                snprintf(resp_body, resp_body_size, "invalid duration");
+                return 400;
+            }
+            if (!offlineStress.start(num)) {
+                snprintf(resp_body, resp_body_size, "offline run already in progress");
+                return 409;
+            }
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        int ret = offlineStress.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/schedule"), NULL)) {
+        if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+        if (evse_id < 0) {
+            snprintf(resp_body, resp_body_size, "missing evse_id");
+            return 400;
+        }
+        int ret = connectors[evse_id-1].getSchedule().writeJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/sampling"), NULL)) {
+        if (evse_id < 0) {
+            snprintf(resp_body, resp_body_size, "missing evse_id");
+            return 400;
+        }
+        auto& evse = connectors[evse_id-1];
+        if (method == MicroOcpp::Method::POST) {
+            struct mg_str interval_str = mg_http_var(query, mg_str("interval"));
+            struct mg_str batch_str = mg_http_var(query, mg_str("batch"));
+            if (!interval_str.buf && !batch_str.buf) {
+                snprintf(resp_body, resp_body_size, "missing interval or batch");
+                return 400;
+            }
+            if (interval_str.buf) {
+                if (!mg_str_to_num(interval_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid interval");
+                    return 400;
+                }
+                evse.setSampleInterval((int)num);
+            }
+            if (batch_str.buf) {
+                if (!mg_str_to_num(batch_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid batch");
+                    return 400;
+                }
+                evse.setBatchInterval((int)num);
+            }
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        unsigned long window = 60000;
+        struct mg_str window_str = mg_http_var(query, mg_str("window"));
+        if (window_str.buf) {
+            if (!mg_str_to_num(window_str, 10, &num, sizeof(num))) {
+                snprintf(resp_body, resp_body_size, "invalid window");
+                return 400;
+            }
+            window = num;
+        }
+
+        auto& sampler = evse.getSampler();
+        int ret = snprintf(resp_body, resp_body_size, "{\"interval\":%i,\"batch\":%i,\"window\":%lu,\"samples\":%lu",
+                evse.getSampleInterval(), evse.getBatchInterval(), window, sampler.getSampleCount());
+        const char *fieldNames [] = {"power", "currentL1", "currentL2", "currentL3", "voltageL1", "voltageL2", "voltageL3"};
+        for (int i = 0; i < MO_SIM_SAMPLE_FIELDS; i++) {
+            if (ret < 0 || ret >= resp_body_size) {
+                break;
+            }
+            auto aggregate = sampler.window((MeterSampler::Field) i, window);
+            ret += snprintf(resp_body + ret, resp_body_size - ret, ",\"%s\":{\"avg\":%.2f,\"min\":%.2f,\"max\":%.2f,\"count\":%u}",
+                    fieldNames[i], aggregate.avg, aggregate.min, aggregate.max, aggregate.count);
+        }
+        if (ret >= 0 && ret < resp_body_size) {
+            ret += snprintf(resp_body + ret, resp_body_size - ret, "}");
+        }
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/fault/clear"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        faultInjector.clear();
+        snprintf(resp_body, resp_body_size, "cleared all faults");
+        return 200;
+    } else if (mg_match(uri, mg_str("/fault"), NULL)) {
+        if (method == MicroOcpp::Method::POST) {
+            FaultInjector::Fault fault;
+
+            char type_buf [16];
+            struct mg_str type_str = mg_http_var(query, mg_str("type"));
+            if (!type_str.buf || type_str.len >= sizeof(type_buf)) {
+                snprintf(resp_body, resp_body_size, "invalid type");
+                return 400;
+            }
+            snprintf(type_buf, sizeof(type_buf), "%.*s", (int)type_str.len, type_str.buf);
+            if (!parseFaultType(type_buf, fault.type)) {
+                snprintf(resp_body, resp_body_size, "invalid type");
+                return 400;
+            }
+
+            fault.connectorId = evse_id > 0 ? evse_id : 1;
+
+            struct mg_str code_str = mg_http_var(query, mg_str("code"));
+            if (code_str.buf) {
+                fault.errorCode = parseFaultErrorCode(code_str.buf, code_str.len);
+                if (!fault.errorCode) {
+                    snprintf(resp_body, resp_body_size, "invalid code");
+                    return 400;
+                }
+            }
+            if (fault.type == FaultType::ErrorCode && !fault.errorCode) {
+                snprintf(resp_body, resp_body_size, "missing code");
+                return 400;
+            }
+
+            //a drift of -1 or lower would stop the meter or run it backwards
+            struct mg_str drift_str = mg_http_var(query, mg_str("drift"));
+            if (drift_str.buf && (!mg_str_to_float(drift_str, fault.drift) || fault.drift <= -1.f)) {
+                snprintf(resp_body, resp_body_size, "invalid drift");
+                return 400;
+            }
+
+            unsigned int delay = 0;
+            struct mg_str delay_str = mg_http_var(query, mg_str("delay"));
+            if (delay_str.buf) {
+                if (!mg_str_to_num(delay_str, 10, &delay, sizeof(delay))) {
+                    snprintf(resp_body, resp_body_size, "invalid delay");
+                    return 400;
+                }
+            }
+
+            struct mg_str duration_str = mg_http_var(query, mg_str("duration"));
+            if (duration_str.buf) {
+                if (!mg_str_to_num(duration_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid duration");
+                    return 400;
+                }
+                fault.duration = (unsigned long) num * 1000UL;
+            }
+
+            bool success;
+            struct mg_str rate_str = mg_http_var(query, mg_str("perHour"));
+            if (rate_str.buf) {
+                float perHour;
+                if (!mg_str_to_float(rate_str, perHour) || !fault.duration) {
+                    snprintf(resp_body, resp_body_size, "invalid perHour or missing duration");
+                    return 400;
+                }
+                success = faultInjector.setRate(fault, perHour);
+            } else {
+                success = faultInjector.schedule(fault, (unsigned long) delay * 1000UL);
+            }
+            if (!success) {
+                snprintf(resp_body, resp_body_size, "too many faults");
+                return 409;
+            }
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        int ret = faultInjector.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/network"), NULL)) {
+        if (method == MicroOcpp::Method::POST) {
+            const char *params [] = {"latency", "jitter", "bandwidth", "loss", "reorder"};
+            int values [] = {-1, -1, -1, -1, -1};
+            for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+                struct mg_str param_str = mg_http_var(query, mg_str(params[i]));
+                if (!param_str.buf) {
+                    continue;
+                }
+                if (!mg_str_to_num(param_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid %s", params[i]);
+                    return 400;
+                }
+                values[i] = (int)num;
+            }
+            netImpairment.update(values[0], values[1], values[2], values[3], values[4]);
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        int ret = snprintf(resp_body, resp_body_size,
+                "{\"latency\":%i,\"jitter\":%i,\"bandwidth\":%i,\"loss\":%i,\"reorder\":%s,\"queued\":%zu,\"dropped\":%lu,\"stalls\":%lu}",
+                netImpairment.getLatency(), netImpairment.getJitter(), netImpairment.getBandwidth(), netImpairment.getLoss(),
+                netImpairment.getReorder() ? "true" : "false",
+                impairedConnection ? impairedConnection->getQueued() : (size_t) 0,
+                impairedConnection ? impairedConnection->getDropped() : 0UL,
+                impairedConnection ? impairedConnection->getStalls() : 0UL);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/site"), NULL)) {
+        if (method == MicroOcpp::Method::POST) {
+            int capacity = site.getCapacity();
+            int phaseCapacity = site.getPhaseCapacity();
+            struct mg_str capacity_str = mg_http_var(query, mg_str("capacity"));
+            if (capacity_str.buf) {
+                if (!mg_str_to_num(capacity_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid capacity");
+                    return 400;
+                }
+                capacity = (int)num;
+            }
+            struct mg_str phase_capacity_str = mg_http_var(query, mg_str("phaseCapacity"));
+            if (phase_capacity_str.buf) {
+                if (!mg_str_to_num(phase_capacity_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid phaseCapacity");
+                    return 400;
+                }
+                phaseCapacity = (int)num;
+            }
+            site.setCapacity(capacity, phaseCapacity);
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        int ret = site.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/profile/reset"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        profiler.reset();
+        return 200;
+    } else if (mg_match(uri, mg_str("/profile"), NULL)) {
+        if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+        int ret = profiler.writeJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/log"), NULL)) {
+        if (method == MicroOcpp::Method::POST) {
+            char level_cstr [16];
+            char category_cstr [16];
+            LogLevel level;
+            LogCategory category;
+            struct mg_str level_str = mg_http_var(query, mg_str("level"));
+            snprintf(level_cstr, sizeof(level_cstr), "%.*s", (int)level_str.len, level_str.buf ? level_str.buf : "");
+            if (!parseLogLevel(level_cstr, level)) {
+                snprintf(resp_body, resp_body_size, "invalid level");
+                return 400;
+            }
+            struct mg_str category_str = mg_http_var(query, mg_str("category"));
+            if (category_str.buf) {
+                snprintf(category_cstr, sizeof(category_cstr), "%.*s", (int)category_str.len, category_str.buf);
+                if (!parseLogCategory(category_cstr, category)) {
+                    snprintf(resp_body, resp_body_size, "invalid category");
+                    return 400;
+                }
+                asyncLogger.setLevel(category, level);
+            } else {
+                //no category applies the level to all categories
+                for (size_t i = 0; i < (size_t) LogCategory::COUNT; i++) {
+                    asyncLogger.setLevel((LogCategory) i, level);
+                }
+            }
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        int ret = asyncLogger.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/history/export"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        long jsonSize = meterHistory.exportJson(MO_FILENAME_PREFIX "sim-history.json");
+        if (jsonSize < 0) {
+            snprintf(resp_body, resp_body_size, "export failed");
+            return 500;
+        }
+        int ret = snprintf(resp_body, resp_body_size, "{\"fn\":\"%s\",\"jsonSize\":%ld}", MO_FILENAME_PREFIX "sim-history.json", jsonSize);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/history"), NULL)) {
+        if (method == MicroOcpp::Method::POST) {
+            struct mg_str interval_str = mg_http_var(query, mg_str("interval"));
+            if (interval_str.buf) {
+                if (!mg_str_to_num(interval_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid interval");
+                    return 400;
+                }
+                meterHistory.setInterval((int)num);
+            }
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        unsigned int limit = 10;
+        struct mg_str limit_str = mg_http_var(query, mg_str("limit"));
+        if (limit_str.buf) {
+            if (!mg_str_to_num(limit_str, 10, &num, sizeof(num))) {
+                snprintf(resp_body, resp_body_size, "invalid limit");
+                return 400;
+            }
+            limit = num;
+        }
+
+        int ret = meterHistory.writeJson(resp_body, resp_body_size, limit);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/tokens/start"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        TokenPopulation::Config config;
+        const char *num_params [] = {"rfid", "emaid", "seed"};
+        unsigned int *num_values [] = {&config.rfid, &config.emaid, &config.seed};
+        for (size_t i = 0; i < sizeof(num_params) / sizeof(num_params[0]); i++) {
+            struct mg_str param_str = mg_http_var(query, mg_str(num_params[i]));
+            if (param_str.buf && !mg_str_to_num(param_str, 10, num_values[i], sizeof(*num_values[i]))) {
+                snprintf(resp_body, resp_body_size, "invalid %s", num_params[i]);
+                return 400;
+            }
+        }
+        const char *float_params [] = {"zipf", "invalid", "blocked", "expired"};
+        float *float_values [] = {&config.zipf, &config.invalid, &config.blocked, &config.expired};
+        for (size_t i = 0; i < sizeof(float_params) / sizeof(float_params[0]); i++) {
+            struct mg_str param_str = mg_http_var(query, mg_str(float_params[i]));
+            if (param_str.buf && !mg_str_to_float(param_str, *float_values[i])) {
+                snprintf(resp_body, resp_body_size, "invalid %s", float_params[i]);
+                return 400;
+            }
+        }
+        const char *dist_params [] = {"arrival", "duration", "energy"};
+        TokenDistribution *dist_values [] = {&config.arrival, &config.duration, &config.energy};
+        for (size_t i = 0; i < sizeof(dist_params) / sizeof(dist_params[0]); i++) {
+            struct mg_str param_str = mg_http_var(query, mg_str(dist_params[i]));
+            if (param_str.buf && !dist_values[i]->parse(param_str.buf, param_str.len)) {
+                snprintf(resp_body, resp_body_size, "invalid %s", dist_params[i]);
+                return 400;
+            }
+        }
+        if (!tokenPopulation.start(config)) {
+            snprintf(resp_body, resp_body_size, "invalid population");
+            return 400;
+        }
+        int ret = tokenPopulation.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/tokens/stop"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        tokenPopulation.stop();
+        int ret = tokenPopulation.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/tokens/list"), NULL)) {
+        if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+        unsigned int offset = 0, limit = 100;
+        struct mg_str offset_str = mg_http_var(query, mg_str("offset"));
+        if (offset_str.buf) {
+            if (!mg_str_to_num(offset_str, 10, &num, sizeof(num))) {
+                snprintf(resp_body, resp_body_size, "invalid offset");
+                return 400;
+            }
+            offset = num;
+        }
+        struct mg_str limit_str = mg_http_var(query, mg_str("limit"));
+        if (limit_str.buf) {
+            if (!mg_str_to_num(limit_str, 10, &num, sizeof(num))) {
+                snprintf(resp_body, resp_body_size, "invalid limit");
+                return 400;
+            }
+            limit = num;
+        }
+        int ret = tokenPopulation.writeListJson(resp_body, resp_body_size, offset, limit);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "response too large, reduce limit");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/tokens"), NULL)) {
+        if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+        int ret = tokenPopulation.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/localauth/run"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        unsigned int entries = 10000, lookups = MO_SIM_LOCALAUTH_LOOKUPS;
+        struct mg_str entries_str = mg_http_var(query, mg_str("entries"));
+        if (entries_str.buf && !mg_str_to_num(entries_str, 10, &entries, sizeof(entries))) {
+            snprintf(resp_body, resp_body_size, "invalid entries");
+            return 400;
+        }
+        struct mg_str lookups_str = mg_http_var(query, mg_str("lookups"));
+        if (lookups_str.buf && !mg_str_to_num(lookups_str, 10, &lookups, sizeof(lookups))) {
+            snprintf(resp_body, resp_body_size, "invalid lookups");
+            return 400;
+        }
+        bool success = localAuthBench.run(entries, lookups);
+        int ret = localAuthBench.writeJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return success ? 200 : 500;
+    } else if (mg_match(uri, mg_str("/localauth/clear"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        if (!localAuthBench.clear()) {
+            snprintf(resp_body, resp_body_size, "cannot clear local list");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/localauth"), NULL)) {
+        if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+        int ret = localAuthBench.writeJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/throughput/start"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        int interval = 1;
+        struct mg_str interval_str = mg_http_var(query, mg_str("interval"));
+        if (interval_str.buf) {
+            if (!mg_str_to_num(interval_str, 10, &num, sizeof(num)) || num < 1) {
+                snprintf(resp_body, resp_body_size, "invalid interval");
+                return 400;
+            }
+            interval = (int)num;
+        }
+        char id_tag [32] = "SIMTX";
+        struct mg_str id_str = mg_http_var(query, mg_str("idTag"));
+        if (id_str.buf) {
+            int ret = snprintf(id_tag, sizeof(id_tag), "%.*s", (int)id_str.len, id_str.buf);
+            if (ret <= 0 || ret > 20) {
+                snprintf(resp_body, resp_body_size, "invalid idTag");
+                return 400;
+            }
+        }
+        if (!txThroughput.start(interval, id_tag)) {
+            snprintf(resp_body, resp_body_size, "cannot start throughput mode");
+            return 400;
+        }
+        int ret = txThroughput.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/throughput/stop"), NULL)) {
+        if (method != MicroOcpp::Method::POST) {
+            return 405;
+        }
+        txThroughput.stop();
+        int ret = txThroughput.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/throughput"), NULL)) {
+        if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+        int ret = txThroughput.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
+        return 200;
+    } else if (mg_match(uri, mg_str("/reboot"), NULL)) {
+        if (method == MicroOcpp::Method::POST) {
+            struct mg_str delay_str = mg_http_var(query, mg_str("delay"));
+            if (delay_str.buf) {
+                if (!mg_str_to_num(delay_str, 10, &num, sizeof(num))) {
+                    snprintf(resp_body, resp_body_size, "invalid delay");
+                    return 400;
+                }
+                simReboot.setDelay((int)num);
+            }
+        } else if (method != MicroOcpp::Method::GET) {
+            return 405;
+        }
+
+        int ret = simReboot.writeStatusJson(resp_body, resp_body_size);
+        if (ret < 0 || ret >= resp_body_size) {
+            snprintf(resp_body, resp_body_size, "internal error");
+            return 500;
+        }
         return 200;
     } else if (mg_match(uri, mg_str("/memory/info"), NULL)) {
         #if MO_OVERRIDE_ALLOCATION && MO_ENABLE_HEAP_PROFILER
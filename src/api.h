@@ -17,6 +17,9 @@ enum class Method {
 
 }
 
+//subscribes the API to the EVSE events. Call after the connectors have been created
+void api_subscribe_events();
+
 int mocpp_api_call(const char *endpoint, MicroOcpp::Method method, const char *body, char *resp_body, size_t resp_body_size);
 
 int mocpp_api2_call(const char *endpoint, size_t endpoint_len, MicroOcpp::Method method, const char *query, size_t query_len, char *resp_body, size_t resp_body_size);
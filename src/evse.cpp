@@ -3,6 +3,9 @@
 // GPL-3.0 License
 
 #include "evse.h"
+#include "journal.h"
+#include "site.h"
+#include "faults.h"
 #include <MicroOcpp.h>
 #include <MicroOcpp/Core/Context.h>
 #include <MicroOcpp/Model/Model.h>
@@ -10,29 +13,21 @@
 #include <MicroOcpp/Model/Transactions/TransactionService.h>
 #include <MicroOcpp/Model/Variables/VariableService.h>
 #include <MicroOcpp/Model/Authorization/IdToken.h>
+#include <MicroOcpp/Model/Metering/MeterValue.h>
+#include <MicroOcpp/Model/Metering/SampledValue.h>
+#include <MicroOcpp/Core/Request.h>
+#include <MicroOcpp/Operations/MeterValues.h>
 #include <MicroOcpp/Operations/StatusNotification.h>
 #include <MicroOcpp/Version.h>
 #include <MicroOcpp/Debug.h>
 #include <cstring>
 #include <cstdlib>
 
-Evse::Evse(unsigned int connectorId) : connectorId{connectorId} {
+Evse::Evse(unsigned int connectorId) : connectorId{connectorId}, schedule{connectorId} {
 
 }
 
-void Evse::setup() {
-
-#if MO_ENABLE_V201
-    if (auto context = getOcppContext()) {
-        if (context->getVersion().major == 2) {
-            //load some example variables for testing
-
-            if (auto varService = context->getModel().getVariableService()) {
-                varService->declareVariable<bool>("AuthCtrlr", "LocalAuthorizeOffline", false, MicroOcpp::Variable::Mutability::ReadOnly, false);
-            }
-        }
-    }
-#endif
+void Evse::declareConfigurations() {
 
     char key [30] = {'\0'};
 
@@ -49,7 +44,51 @@ void Evse::setup() {
     trackEvseReadyKey = key;
     trackEvseReadyBool = MicroOcpp::declareConfiguration(trackEvseReadyKey.c_str(), false, SIMULATOR_FN, false, false, false);
 
-    MicroOcpp::configuration_load(SIMULATOR_FN);
+    snprintf(key, 30, "energy_cId_%u", connectorId);
+    energyKey = key;
+
+    //shared by all connectors
+    sampleIntervalInt = MicroOcpp::declareConfiguration<int>("simSampleInterval", MO_SIM_SAMPLE_INTERVAL, SIMULATOR_FN, false, false, false);
+    batchIntervalInt = MicroOcpp::declareConfiguration<int>("simBatchInterval", 0, SIMULATOR_FN, false, false, false);
+    batchSuspendedIntervalInt = MicroOcpp::declareConfiguration<int>("simBatchSuspendedInterval", -1, SIMULATOR_FN, false, false, false);
+}
+
+void Evse::setup() {
+
+#if MO_ENABLE_V201
+    if (auto context = getOcppContext()) {
+        if (context->getVersion().major == 2) {
+            //load some example variables for testing
+
+            if (auto varService = context->getModel().getVariableService()) {
+                varService->declareVariable<bool>("AuthCtrlr", "LocalAuthorizeOffline", false, MicroOcpp::Variable::Mutability::ReadOnly, false);
+            }
+        }
+    }
+#endif
+
+    //the journal holds the latest simulator state and takes precedence over simulator.jsn
+    auto restoreBool = [] (std::shared_ptr<MicroOcpp::Configuration> config, const std::string& key) {
+        bool val;
+        if (stateJournal.getBool(key.c_str(), val)) {
+            config->setBool(val);
+        }
+    };
+    restoreBool(trackEvPluggedBool, trackEvPluggedKey);
+    restoreBool(trackEvsePluggedBool, trackEvsePluggedKey);
+    restoreBool(trackEvReadyBool, trackEvReadyKey);
+    restoreBool(trackEvseReadyBool, trackEvseReadyKey);
+
+    updateInputs();
+
+    int energy;
+    if (stateJournal.getInt(energyKey.c_str(), energy)) {
+        simulate_energy = (float) energy;
+    }
+
+    //the timeline and power output of a previous MicroOcpp instance don't apply after a reboot
+    schedule.reset();
+    limit_power = SIMULATE_POWER_CONST;
 
     setConnectorPluggedInput([this] () -> bool {
         return trackEvPluggedBool->getBool(); //return if J1772 is in State B or C
@@ -64,36 +103,17 @@ void Evse::setup() {
     }, connectorId);
 
     addErrorCodeInput([this] () -> const char* {
-        const char *errorCode = nullptr; //if error is present, point to error code; any number of error code samplers can be added in this project
-        return errorCode;
+        return faultInjector.getErrorCode(connectorId); //nullptr if no fault is injected
     }, connectorId);
 
     setEnergyMeterInput([this] () -> float {
-        return simulate_energy;
+        return simulate_energy; //drift is applied to the increments in loop(), so the register never runs backwards
     }, connectorId);
 
     setPowerMeterInput([this] () -> float {
-        return simulate_power;
+        return simulate_power * faultInjector.getMeterFactor(connectorId);
     }, connectorId);
 
-    addMeterValueInput([this] () {
-            return (int32_t) getCurrent();
-        }, 
-        "Current.Import",
-        "A",
-        "Outlet",
-        nullptr,
-        connectorId);
-    
-    addMeterValueInput([this] () {
-            return (int32_t) getVoltage();
-        }, 
-        "Voltage",
-        "V",
-        nullptr,
-        nullptr,
-        connectorId);
-    
     addMeterValueInput([this] () {
             return (int32_t) (simulate_power > 1.f ? 44.f : 0.f);
         }, 
@@ -103,9 +123,44 @@ void Evse::setup() {
         nullptr,
         connectorId);
 
-    setOnResetExecute([] (bool isHard) {
-        exit(0);
-    });
+    //MicroOcpp has declared its sampling interval during initialization already
+    ocppSampleIntervalInt = nullptr;
+    txUpdatedIntervalVar = nullptr;
+#if MO_ENABLE_V201
+    if (getOcppContext()->getVersion().major == 2) {
+        if (auto varService = getOcppContext()->getModel().getVariableService()) {
+            txUpdatedIntervalVar = varService->declareVariable<int>("SampledDataCtrlr", "TxUpdatedInterval", 0);
+        }
+    } else
+#endif
+    {
+        ocppSampleIntervalInt = MicroOcpp::declareConfiguration<int>("MeterValueSampleInterval", 60);
+        updateOcppSampling();
+    }
+
+    //per-phase readings from the high-rate sampler. Each value is the average over MicroOcpp's sampling interval.
+    //They replace the single-phase Current.Import and Voltage inputs, so each measurand is reported once
+    static const char *phasesCurrent [] = {"L1", "L2", "L3"};
+    static const char *phasesVoltage [] = {"L1-N", "L2-N", "L3-N"};
+    for (int i = 0; i < 3; i++) {
+        addMeterValueInput([this, i] () {
+                return sampler.interval((MeterSampler::Field) (MeterSampler::CurrentL1 + i), getOcppSampleInterval()).avg;
+            },
+            "Current.Import",
+            "A",
+            "Outlet",
+            phasesCurrent[i],
+            connectorId);
+
+        addMeterValueInput([this, i] () {
+                return sampler.interval((MeterSampler::Field) (MeterSampler::VoltageL1 + i), getOcppSampleInterval()).avg;
+            },
+            "Voltage",
+            "V",
+            nullptr,
+            phasesVoltage[i],
+            connectorId);
+    }
 
     setSmartChargingPowerOutput([this] (float limit) {
         if (limit >= 0.f) {
@@ -115,34 +170,239 @@ void Evse::setup() {
             // negative value means no limit defined
             this->limit_power = SIMULATE_POWER_CONST;
         }
+        schedule.invalidate();
+        wakeUp = true;
     }, connectorId);
 }
 
 void Evse::loop() {
 
+    //an idle connector only changes through the setters or the OCPP status. MicroOcpp has no status
+    //callback, so poll the status at a lower rate and skip the rest of the loop until something changes
+    bool idle = !wakeUp && !inputsReady && !charging && idleSampled &&
+            simulate_power == 0.f && site_reported_power == simulate_power;
+    if (idle && mocpp_tick_ms() - lastStatusPoll < MO_SIM_IDLE_POLL_INTERVAL) {
+        return;
+    }
+    lastStatusPoll = mocpp_tick_ms();
+
     auto curStatus = getChargePointStatus(connectorId);
 
-    if (status.compare(MicroOcpp::cstrFromOcppEveState(curStatus))) {
+    if ((int) curStatus != statusCode) {
+        statusCode = (int) curStatus;
         status = MicroOcpp::cstrFromOcppEveState(curStatus);
+        notify(EvseEvent::StatusChanged);
+    } else if (idle) {
+        return;
     }
+    wakeUp = false;
+
+    schedule.loop();
 
-    bool simulate_isCharging = ocppPermitsCharge(connectorId) && trackEvPluggedBool->getBool() && trackEvsePluggedBool->getBool() && trackEvReadyBool->getBool() && trackEvseReadyBool->getBool();
+    //inputsReady is updated by the setters, so idle connectors skip the OCPP permission check
+    bool simulate_isCharging = inputsReady && ocppPermitsCharge(connectorId);
 
-    simulate_isCharging &= limit_power >= 720.f; //minimum charging current is 6A (720W for 120V grids) according to J1772
+    numberPhases = MO_SIM_SITE_PHASES;
+    float limit = getPowerLimit(&numberPhases);
+
+    simulate_isCharging &= limit >= 720.f; //minimum charging current is 6A (720W for 120V grids) according to J1772
+
+    if (simulate_isCharging != charging) {
+        charging = simulate_isCharging;
+        notify(charging ? EvseEvent::ChargingStarted : EvseEvent::ChargingStopped);
+    }
 
     if (simulate_isCharging) {
         if (simulate_power >= 1.f) {
-            simulate_energy += (float) (mocpp_tick_ms() - simulate_energy_track_time) * simulate_power * (0.001f / 3600.f);
+            simulate_energy += (float) (mocpp_tick_ms() - simulate_energy_track_time) * simulate_power * (0.001f / 3600.f)
+                    * faultInjector.getMeterFactor(connectorId);
         }
 
         simulate_power = SIMULATE_POWER_CONST;
-        simulate_power = std::min(simulate_power, limit_power);
+        simulate_power = std::min(simulate_power, limit);
         simulate_power += (((mocpp_tick_ms() / 5000) * 3483947) % 20000) * 0.001f - 10.f;
         simulate_energy_track_time = mocpp_tick_ms();
+
+        if (mocpp_tick_ms() - simulate_energy_journal_time >= SIMULATE_ENERGY_JOURNAL_INTERVAL_MS) {
+            simulate_energy_journal_time = mocpp_tick_ms();
+            stateJournal.setInt(energyKey.c_str(), (int) simulate_energy);
+        }
     } else {
+        if (simulate_power >= 1.f) {
+            //charging stopped
+            stateJournal.setInt(energyKey.c_str(), (int) simulate_energy);
+        }
         simulate_power = 0.f;
     }
 
+    if (simulate_isCharging || simulate_power != site_reported_power) {
+        site.updatePower(connectorId, simulate_power, numberPhases);
+        site_reported_power = simulate_power;
+    }
+
+    unsigned long samplesBefore = sampler.getSampleCount();
+    sampler.loop((unsigned long) std::max(0, getSampleInterval()), connectorId, simulate_power, getVoltage(), numberPhases);
+    if (simulate_power != 0.f) {
+        idleSampled = false;
+    } else if (sampler.getSampleCount() != samplesBefore || getSampleInterval() <= 0) {
+        idleSampled = true; //the readings stay at this sample while the connector is idle
+    }
+
+    if (getBatchInterval() > 0 && mocpp_tick_ms() - lastBatch >= (unsigned long) getBatchInterval() * 1000UL) {
+        lastBatch = mocpp_tick_ms();
+        sendMeterBatch();
+    }
+}
+
+float Evse::getPowerLimit(int *numberPhasesOut) {
+    //the precomputed timeline follows the profiles over time. Until the clock is set or if the
+    //current time is outside of the timeline, MicroOcpp's power output is the best estimate
+    auto context = getOcppContext();
+    float limit;
+    if (!context || !schedule.getLimit(context->getModel().getClock().now(), limit, numberPhasesOut)) {
+        return limit_power;
+    }
+    return limit >= 0.f ? limit : SIMULATE_POWER_CONST; //negative means unlimited
+}
+
+unsigned long Evse::getOcppSampleInterval() {
+    int interval = 0;
+#if MO_ENABLE_V201
+    if (txUpdatedIntervalVar) {
+        interval = txUpdatedIntervalVar->getInt();
+    } else
+#endif
+    if (batchSuspendedIntervalInt && batchSuspendedIntervalInt->getInt() >= 0) {
+        interval = batchSuspendedIntervalInt->getInt(); //MicroOcpp's sampling is suspended while batching
+    } else if (ocppSampleIntervalInt) {
+        interval = ocppSampleIntervalInt->getInt();
+    }
+    return (unsigned long) std::max(0, interval) * 1000UL;
+}
+
+//properties of the batched sampled values in the order of MeterSampler::Field. MicroOcpp keeps references to them
+static std::array<MicroOcpp::SampledValueProperties, MO_SIM_SAMPLE_FIELDS>& getBatchProperties() {
+    static std::array<MicroOcpp::SampledValueProperties, MO_SIM_SAMPLE_FIELDS> properties;
+    static bool initialized = false;
+    if (!initialized) {
+        properties[MeterSampler::Power].setMeasurand("Power.Active.Import");
+        properties[MeterSampler::Power].setUnit("W");
+        const char *phasesCurrent [] = {"L1", "L2", "L3"};
+        const char *phasesVoltage [] = {"L1-N", "L2-N", "L3-N"};
+        for (int i = 0; i < 3; i++) {
+            properties[MeterSampler::CurrentL1 + i].setMeasurand("Current.Import");
+            properties[MeterSampler::CurrentL1 + i].setUnit("A");
+            properties[MeterSampler::CurrentL1 + i].setLocation("Outlet");
+            properties[MeterSampler::CurrentL1 + i].setPhase(phasesCurrent[i]);
+            properties[MeterSampler::VoltageL1 + i].setMeasurand("Voltage");
+            properties[MeterSampler::VoltageL1 + i].setUnit("V");
+            properties[MeterSampler::VoltageL1 + i].setPhase(phasesVoltage[i]);
+        }
+        initialized = true;
+    }
+    return properties;
+}
+
+void Evse::sendMeterBatch() {
+    auto context = getOcppContext();
+    unsigned long sampleCount = sampler.getSampleCount();
+
+    //OCPP 1.6 only: in 2.0.1, MicroOcpp sends the meter data of a transaction within TransactionEvent
+    if (!context || context->getVersion().major != 1 || !isTransactionRunning(connectorId)) {
+        batchCursor = sampleCount;
+        return;
+    }
+
+    auto now = context->getModel().getClock().now();
+    if (now < MicroOcpp::MIN_TIME) {
+        return; //wait until the clock is set, the samples stay in the ring buffer
+    }
+    auto tick = mocpp_tick_ms();
+    auto& properties = getBatchProperties();
+
+    std::vector<std::unique_ptr<MicroOcpp::MeterValue>> meterValues;
+    for (; batchCursor < sampleCount; batchCursor++) {
+        unsigned long time;
+        const float *values = sampler.getSample(batchCursor, &time);
+        if (!values) {
+            continue; //overwritten before it was sent
+        }
+        auto meterValue = std::unique_ptr<MicroOcpp::MeterValue>(new MicroOcpp::MeterValue(now - (int) ((tick - time) / 1000UL)));
+        for (int i = 0; i < MO_SIM_SAMPLE_FIELDS; i++) {
+            meterValue->addSampledValue(std::unique_ptr<MicroOcpp::SampledValue>(
+                    new MicroOcpp::SampledValueConcrete<float, MicroOcpp::SampledValueDeSerializer<float>>(
+                        properties[i], MicroOcpp::ReadingContext::SamplePeriodic, float(values[i]))));
+        }
+        meterValues.push_back(std::move(meterValue));
+
+        if (meterValues.size() >= MO_SIM_METER_BATCH_MAX || batchCursor + 1 == sampleCount) {
+            context->initiateRequest(MicroOcpp::makeRequest(new MicroOcpp::Ocpp16::MeterValues(
+                    context->getModel(), std::move(meterValues), connectorId, getTransaction(connectorId))));
+            meterValues.clear();
+        }
+    }
+}
+
+void Evse::saveState() {
+    stateJournal.setInt(energyKey.c_str(), (int) simulate_energy);
+}
+
+int Evse::getSampleInterval() {
+    return sampleIntervalInt ? sampleIntervalInt->getInt() : 0;
+}
+
+void Evse::setSampleInterval(int interval) {
+    if (!sampleIntervalInt || sampleIntervalInt->getInt() == interval) return;
+    sampleIntervalInt->setInt(interval);
+    MicroOcpp::configuration_save();
+}
+
+int Evse::getBatchInterval() {
+    return batchIntervalInt ? batchIntervalInt->getInt() : 0;
+}
+
+void Evse::setBatchInterval(int interval) {
+    if (!batchIntervalInt || batchIntervalInt->getInt() == interval) return;
+    batchIntervalInt->setInt(interval);
+    updateOcppSampling();
+    MicroOcpp::configuration_save();
+}
+
+void Evse::updateOcppSampling() {
+    //OCPP 1.6 only. The settings are shared by all connectors, so the first one does the switch
+    if (!ocppSampleIntervalInt || !batchSuspendedIntervalInt) {
+        return;
+    }
+    bool batching = getBatchInterval() > 0;
+    bool suspended = batchSuspendedIntervalInt->getInt() >= 0;
+    if (batching && !suspended) {
+        batchSuspendedIntervalInt->setInt(std::max(0, ocppSampleIntervalInt->getInt()));
+        ocppSampleIntervalInt->setInt(0);
+        MicroOcpp::configuration_save();
+    } else if (!batching && suspended) {
+        ocppSampleIntervalInt->setInt(batchSuspendedIntervalInt->getInt());
+        batchSuspendedIntervalInt->setInt(-1);
+        MicroOcpp::configuration_save();
+    }
+}
+
+void Evse::addListener(EvseListener listener) {
+    listeners.push_back(std::move(listener));
+}
+
+void Evse::notify(EvseEvent event) {
+    for (auto& listener : listeners) {
+        listener(*this, event);
+    }
+}
+
+void Evse::updateInputs() {
+    inputsReady = trackEvPluggedBool && trackEvPluggedBool->getBool() &&
+            trackEvsePluggedBool && trackEvsePluggedBool->getBool() &&
+            trackEvReadyBool && trackEvReadyBool->getBool() &&
+            trackEvseReadyBool && trackEvseReadyBool->getBool();
+    wakeUp = true;
+    notify(EvseEvent::InputsChanged);
 }
 
 void Evse::presentNfcTag(const char *uid) {
@@ -195,8 +455,10 @@ bool Evse::presentNfcTag(const char *uid, const char *type) {
 
 void Evse::setEvPlugged(bool plugged) {
     if (!trackEvPluggedBool) return;
+    if (trackEvPluggedBool->getBool() == plugged) return;
     trackEvPluggedBool->setBool(plugged);
-    MicroOcpp::configuration_save();
+    stateJournal.setBool(trackEvPluggedKey.c_str(), plugged);
+    updateInputs();
 }
 
 bool Evse::getEvPlugged() {
@@ -206,8 +468,10 @@ bool Evse::getEvPlugged() {
 
 void Evse::setEvsePlugged(bool plugged) {
     if (!trackEvsePluggedBool) return;
+    if (trackEvsePluggedBool->getBool() == plugged) return;
     trackEvsePluggedBool->setBool(plugged);
-    MicroOcpp::configuration_save();
+    stateJournal.setBool(trackEvsePluggedKey.c_str(), plugged);
+    updateInputs();
 }
 
 bool Evse::getEvsePlugged() {
@@ -217,8 +481,10 @@ bool Evse::getEvsePlugged() {
 
 void Evse::setEvReady(bool ready) {
     if (!trackEvReadyBool) return;
+    if (trackEvReadyBool->getBool() == ready) return;
     trackEvReadyBool->setBool(ready);
-    MicroOcpp::configuration_save();
+    stateJournal.setBool(trackEvReadyKey.c_str(), ready);
+    updateInputs();
 }
 
 bool Evse::getEvReady() {
@@ -228,8 +494,10 @@ bool Evse::getEvReady() {
 
 void Evse::setEvseReady(bool ready) {
     if (!trackEvseReadyBool) return;
+    if (trackEvseReadyBool->getBool() == ready) return;
     trackEvseReadyBool->setBool(ready);
-    MicroOcpp::configuration_save();
+    stateJournal.setBool(trackEvseReadyKey.c_str(), ready);
+    updateInputs();
 }
 
 bool Evse::getEvseReady() {
@@ -6,12 +6,44 @@
 #define EVSE_H
 
 #include <array>
+#include <functional>
 #include <string>
+#include <vector>
 #include <MicroOcpp/Core/Configuration.h>
 #include <MicroOcpp/Version.h>
 
+#include "schedule.h"
+#include "sampling.h"
+
 #define SIMULATOR_FN MO_FILENAME_PREFIX "simulator.jsn"
 
+#ifndef MO_SIM_SAMPLE_INTERVAL
+#define MO_SIM_SAMPLE_INTERVAL 1000 //default interval of the meter sampling in ms
+#endif
+
+#ifndef MO_SIM_IDLE_POLL_INTERVAL
+#define MO_SIM_IDLE_POLL_INTERVAL 500 //interval in ms in which idle connectors poll the OCPP status
+#endif
+
+#ifndef MO_SIM_METER_BATCH_MAX
+#define MO_SIM_METER_BATCH_MAX 60 //maximum number of samples per batched MeterValues message
+#endif
+
+namespace MicroOcpp {
+class Variable;
+}
+
+class Evse;
+
+enum class EvseEvent {
+    StatusChanged,  //OCPP status changed
+    InputsChanged,  //EV / EVSE plugged or ready changed
+    ChargingStarted,
+    ChargingStopped
+};
+
+using EvseListener = std::function<void(Evse& evse, EvseEvent event)>;
+
 class Evse {
 private:
     const unsigned int connectorId;
@@ -27,19 +59,62 @@ private:
 
     const float SIMULATE_POWER_CONST = 11000.f;
     float simulate_power = 0;
-    float limit_power = 11000.f;
+    float limit_power = 11000.f; //MicroOcpp's power output, only used until the schedule timeline is valid
     const float SIMULATE_ENERGY_DELTA_MS = SIMULATE_POWER_CONST / (3600.f * 1000.f);
     unsigned long simulate_energy_track_time = 0;
     float simulate_energy = 0;
+    std::string energyKey;
+    const unsigned long SIMULATE_ENERGY_JOURNAL_INTERVAL_MS = 60000;
+    unsigned long simulate_energy_journal_time = 0;
 
     std::string status;
+    int statusCode = -1; //ChargePointStatus enum value
+
+    bool inputsReady = false; //EV and EVSE plugged and ready
+    bool charging = false;
+    float site_reported_power = -1.f;
+
+    //idle connectors skip the loop until an input or the OCPP status changes
+    bool wakeUp = true;
+    bool idleSampled = false; //the sampler holds a reading of the idle connector
+    unsigned long lastStatusPoll = 0;
+
+    std::vector<EvseListener> listeners;
+    void notify(EvseEvent event);
+    void updateInputs();
+
+    ScheduleTimeline schedule;
+
+    std::shared_ptr<MicroOcpp::Configuration> sampleIntervalInt;
+    std::shared_ptr<MicroOcpp::Configuration> batchIntervalInt; //in s, 0 disables the batched MeterValues
+    std::shared_ptr<MicroOcpp::Configuration> batchSuspendedIntervalInt; //MeterValueSampleInterval to restore after batching, -1 if not suspended
+    MeterSampler sampler;
+    int numberPhases = 3;
+    unsigned long batchCursor = 0; //next sample number to send
+    unsigned long lastBatch = 0;
+
+    //MicroOcpp's sampling interval, which the MeterValue inputs aggregate over
+    std::shared_ptr<MicroOcpp::Configuration> ocppSampleIntervalInt;
+    MicroOcpp::Variable *txUpdatedIntervalVar = nullptr;
+    unsigned long getOcppSampleInterval(); //in ms
+
+    //while batching, the batches replace MicroOcpp's periodic MeterValues
+    void updateOcppSampling();
+
+    void sendMeterBatch();
 public:
     Evse(unsigned int connectorId);
 
+    //declare the persistent simulator state. Must be called before loading SIMULATOR_FN
+    void declareConfigurations();
+
     void setup();
 
     void loop();
 
+    //journals the energy meter, which is otherwise only written periodically while charging
+    void saveState();
+
     void presentNfcTag(const char *uid);
 
 #if MO_ENABLE_V201
@@ -67,13 +142,20 @@ public:
     bool chargingPermitted();
 
     bool isCharging() {
-        return chargingPermitted() && trackEvReadyBool->getBool();
+        return charging;
     }
 
     const char *getOcppStatus() {
         return status.c_str();
     }
 
+    int getOcppStatusCode() {
+        return statusCode;
+    }
+
+    //the listener is called on state changes during loop() and in the setters
+    void addListener(EvseListener listener);
+
     unsigned int getConnectorId() {
         return connectorId;
     }
@@ -94,10 +176,27 @@ public:
         return 0.333f * (float) getPower() / volts;
     }
 
+    //returns the limit in W which applies now and optionally its number of phases
+    float getPowerLimit(int *numberPhasesOut = nullptr);
+
     int getSmartChargingMaxPower() {
-        return limit_power;
+        return (int) getPowerLimit();
+    }
+
+    ScheduleTimeline& getSchedule() {
+        return schedule;
     }
 
+    MeterSampler& getSampler() {
+        return sampler;
+    }
+
+    int getSampleInterval();
+    void setSampleInterval(int interval);
+
+    int getBatchInterval();
+    void setBatchInterval(int interval);
+
     float getSmartChargingMaxCurrent() {
         float volts = getVoltage();
         if (volts <= 0.f) {
@@ -0,0 +1,243 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "faults.h"
+
+#include <cstdio>
+#include <cstring>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "reconnect.h"
+#include "traffic.h"
+
+const char *cstrFromFaultType(FaultType type) {
+    switch (type) {
+        case FaultType::ErrorCode:
+            return "errorCode";
+        case FaultType::MeterDrift:
+            return "meterDrift";
+        case FaultType::WsDrop:
+            return "wsDrop";
+        case FaultType::WsStall:
+            return "wsStall";
+    }
+    return "undefined";
+}
+
+bool parseFaultType(const char *cstr, FaultType& out) {
+    for (auto type : {FaultType::ErrorCode, FaultType::MeterDrift, FaultType::WsDrop, FaultType::WsStall}) {
+        if (!strcmp(cstr, cstrFromFaultType(type))) {
+            out = type;
+            return true;
+        }
+    }
+    return false;
+}
+
+//OCPP 1.6 ChargePointErrorCode values apart from NoError
+static const char *faultErrorCodes [] = {
+    "ConnectorLockFailure",
+    "EVCommunicationError",
+    "GroundFailure",
+    "HighTemperature",
+    "InternalError",
+    "LocalListConflict",
+    "OtherError",
+    "OverCurrentFailure",
+    "OverVoltage",
+    "PowerMeterFailure",
+    "PowerSwitchFailure",
+    "ReaderFailure",
+    "ResetFailure",
+    "UnderVoltage",
+    "WeakSignal"
+};
+
+const char *parseFaultErrorCode(const char *cstr, size_t len) {
+    for (size_t i = 0; i < sizeof(faultErrorCodes) / sizeof(faultErrorCodes[0]); i++) {
+        if (strlen(faultErrorCodes[i]) == len && !strncmp(cstr, faultErrorCodes[i], len)) {
+            return faultErrorCodes[i];
+        }
+    }
+    return nullptr;
+}
+
+void FaultInjector::setup(ReconnectBackoff *backoff, TrafficMeter *traffic) {
+    this->backoff = backoff;
+    this->traffic = traffic;
+
+    //after a simulated reboot, apply the active WsDrop and WsStall faults to the new connection
+    if (backoff && wsDropped) {
+        backoff->setOffline(OfflineSource::Fault, true);
+    }
+    if (traffic && wsStalled) {
+        traffic->setStalled(true);
+    }
+}
+
+float FaultInjector::random() {
+    //xorshift32
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (float) (rng >> 8) / (float) (1U << 24);
+}
+
+bool FaultInjector::schedule(const Fault& fault, unsigned long delay) {
+    if (faults.size() >= MO_SIM_FAULTS_MAX) {
+        MO_DBG_WARN("too many faults");
+        return false;
+    }
+    if (fault.type == FaultType::ErrorCode && !fault.errorCode) {
+        MO_DBG_WARN("missing error code");
+        return false;
+    }
+    faults.push_back(fault);
+    faults.back().start = mocpp_tick_ms() + delay;
+    faults.back().active = false;
+    return true;
+}
+
+bool FaultInjector::setRate(const Fault& fault, float perHour) {
+    for (auto it = rates.begin(); it != rates.end(); it++) {
+        if (it->fault.type == fault.type && it->fault.connectorId == fault.connectorId && it->fault.errorCode == fault.errorCode) {
+            if (perHour > 0.f) {
+                it->fault = fault;
+                it->perHour = perHour;
+            } else {
+                rates.erase(it);
+            }
+            return true;
+        }
+    }
+    if (perHour <= 0.f) {
+        return true;
+    }
+    if (rates.size() >= MO_SIM_FAULTS_MAX) {
+        MO_DBG_WARN("too many fault rates");
+        return false;
+    }
+    Rate rate;
+    rate.fault = fault;
+    rate.perHour = perHour;
+    rates.push_back(rate);
+    return true;
+}
+
+void FaultInjector::clear() {
+    faults.clear();
+    rates.clear();
+    apply();
+}
+
+void FaultInjector::loop() {
+    auto now = mocpp_tick_ms();
+
+    if (!rates.empty() && now - lastRoll >= 1000) {
+        lastRoll = now;
+        for (auto& rate : rates) {
+            if (random() < rate.perHour / 3600.f && faults.size() < MO_SIM_FAULTS_MAX) {
+                faults.push_back(rate.fault);
+                faults.back().start = now;
+                triggered++;
+            }
+        }
+    }
+
+    bool changed = false;
+    for (auto it = faults.begin(); it != faults.end();) {
+        if (!it->active && (long) (now - it->start) >= 0) {
+            MO_DBG_INFO("inject fault %s at connector %u", cstrFromFaultType(it->type), it->connectorId);
+            it->active = true;
+            changed = true;
+        }
+        if (it->active && it->duration && now - it->start >= it->duration) {
+            MO_DBG_INFO("clear fault %s at connector %u", cstrFromFaultType(it->type), it->connectorId);
+            it = faults.erase(it);
+            changed = true;
+            continue;
+        }
+        it++;
+    }
+
+    if (changed) {
+        apply();
+    }
+}
+
+void FaultInjector::apply() {
+    bool drop = false, stall = false;
+    for (auto& fault : faults) {
+        drop |= fault.active && fault.type == FaultType::WsDrop;
+        stall |= fault.active && fault.type == FaultType::WsStall;
+    }
+
+    if (drop != wsDropped && backoff) {
+        backoff->setOffline(OfflineSource::Fault, drop);
+    }
+    wsDropped = drop;
+
+    if (stall != wsStalled && traffic) {
+        traffic->setStalled(stall);
+    }
+    wsStalled = stall;
+}
+
+const char *FaultInjector::getErrorCode(unsigned int connectorId) {
+    for (auto& fault : faults) {
+        if (fault.active && fault.type == FaultType::ErrorCode && fault.connectorId == connectorId) {
+            return fault.errorCode; //static lifetime, MicroOcpp may keep it until the StatusNotification is sent
+        }
+    }
+    return nullptr;
+}
+
+float FaultInjector::getMeterFactor(unsigned int connectorId) {
+    float factor = 1.f;
+    for (auto& fault : faults) {
+        if (fault.active && fault.type == FaultType::MeterDrift && fault.connectorId == connectorId) {
+            factor *= 1.f + fault.drift;
+        }
+    }
+    return factor;
+}
+
+int FaultInjector::writeStatusJson(char *buf, size_t size) {
+    auto now = mocpp_tick_ms();
+    int written = snprintf(buf, size, "{\"triggered\":%lu,\"faults\":[", triggered);
+
+    for (size_t i = 0; i < faults.size(); i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        auto& fault = faults[i];
+        written += snprintf(buf + written, size - written,
+                "%s{\"type\":\"%s\",\"evseId\":%u,\"errorCode\":\"%s\",\"drift\":%.3f,\"active\":%s,\"in\":%li,\"duration\":%lu}",
+                i ? "," : "", cstrFromFaultType(fault.type), fault.connectorId, fault.errorCode ? fault.errorCode : "", fault.drift,
+                fault.active ? "true" : "false", fault.active ? 0L : (long) (fault.start - now), fault.duration);
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "],\"rates\":[");
+
+    for (size_t i = 0; i < rates.size(); i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        auto& rate = rates[i];
+        written += snprintf(buf + written, size - written,
+                "%s{\"type\":\"%s\",\"evseId\":%u,\"errorCode\":\"%s\",\"drift\":%.3f,\"perHour\":%.3f,\"duration\":%lu}",
+                i ? "," : "", cstrFromFaultType(rate.fault.type), rate.fault.connectorId, rate.fault.errorCode ? rate.fault.errorCode : "",
+                rate.fault.drift, rate.perHour, rate.fault.duration);
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "]}");
+    return written;
+}
@@ -0,0 +1,93 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_FAULTS_H
+#define MO_SIM_FAULTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef MO_SIM_FAULTS_MAX
+#define MO_SIM_FAULTS_MAX 32 //maximum number of scheduled and active faults
+#endif
+
+class ReconnectBackoff;
+class TrafficMeter;
+
+enum class FaultType {
+    ErrorCode,  //connector reports an error code, e.g. GroundFailure or OverCurrentFailure
+    MeterDrift, //energy and power readings deviate by a relative error
+    WsDrop,     //WebSocket is closed and not reopened
+    WsStall     //outgoing messages are held back
+};
+
+const char *cstrFromFaultType(FaultType type);
+bool parseFaultType(const char *cstr, FaultType& out);
+
+//returns the ChargePointErrorCode literal which matches the string, or nullptr if it's no valid error code
+const char *parseFaultErrorCode(const char *cstr, size_t len);
+
+/*
+ * Injects faults into the simulated charger. Faults are scheduled with a delay and a duration,
+ * or triggered randomly with a rate per hour. Error codes are reported through the error code
+ * input of the connector, so MicroOcpp sends the Faulted status and stops charging
+ */
+class FaultInjector {
+public:
+    struct Fault {
+        FaultType type = FaultType::ErrorCode;
+        unsigned int connectorId = 1; //ignored for WsDrop and WsStall
+        const char *errorCode = nullptr; //ErrorCode only, literal from parseFaultErrorCode()
+        float drift = 0.f; //MeterDrift only, relative error, e.g. 0.05 for +5 %
+        unsigned long start = 0; //mocpp_tick_ms() when the fault becomes active
+        unsigned long duration = 0; //in ms, 0 until cleared
+        bool active = false;
+    };
+
+    struct Rate {
+        Fault fault; //template of the triggered fault
+        float perHour = 0.f;
+    };
+private:
+    ReconnectBackoff *backoff = nullptr;
+    TrafficMeter *traffic = nullptr;
+
+    std::vector<Fault> faults;
+    std::vector<Rate> rates;
+    unsigned long lastRoll = 0;
+    uint32_t rng = 2463534242U;
+    unsigned long triggered = 0;
+
+    bool wsDropped = false;
+    bool wsStalled = false;
+
+    float random();
+    void apply();
+public:
+    void setup(ReconnectBackoff *backoff, TrafficMeter *traffic);
+
+    //activates the fault after delay ms
+    bool schedule(const Fault& fault, unsigned long delay);
+
+    //triggers the fault randomly with the given rate. perHour 0 removes the rate
+    bool setRate(const Fault& fault, float perHour);
+
+    //removes all faults and rates
+    void clear();
+
+    void loop();
+
+    //returns the error code of the first active ErrorCode fault, or nullptr
+    const char *getErrorCode(unsigned int connectorId);
+
+    //returns the factor for the power reading and the energy increments, 1 without drift
+    float getMeterFactor(unsigned int connectorId);
+
+    int writeStatusJson(char *buf, size_t size);
+};
+
+extern FaultInjector faultInjector;
+
+#endif
@@ -0,0 +1,417 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "fs_memory.h"
+
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#if MO_SIM_RAMFS_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define MO_SIM_RAMFS_MAGIC "MOFS"
+#define MO_SIM_RAMFS_VERSION 1
+#define MO_SIM_RAMFS_HEADER_SIZE 16 //magic (4), version (1), reserved (3), payload length (4), checksum (4)
+
+namespace {
+
+class MemoryFileAdapter : public MicroOcpp::FileAdapter {
+private:
+    MemoryFilesystemAdapter::FileData data;
+    MemoryFilesystemAdapter& filesystem;
+    size_t pos = 0;
+public:
+    MemoryFileAdapter(MemoryFilesystemAdapter::FileData data, MemoryFilesystemAdapter& filesystem, size_t pos) :
+            data(data), filesystem(filesystem), pos(pos) { }
+
+    size_t read(char *buf, size_t len) override {
+        if (pos >= data->size()) {
+            return 0;
+        }
+        len = std::min(len, data->size() - pos);
+        memcpy(buf, data->data() + pos, len);
+        pos += len;
+        return len;
+    }
+
+    size_t write(const char *buf, size_t len) override {
+        if (pos + len > data->size()) {
+            data->resize(pos + len);
+        }
+        memcpy(data->data() + pos, buf, len);
+        pos += len;
+        filesystem.setModified();
+        return len;
+    }
+
+    size_t seek(size_t offset) override {
+        if (offset > data->size()) {
+            return -1;
+        }
+        pos = offset;
+        return 0;
+    }
+
+    int read() override {
+        if (pos >= data->size()) {
+            return -1;
+        }
+        return (unsigned char) (*data)[pos++];
+    }
+};
+
+//FNV-1a
+uint32_t imageChecksum(const char *buf, size_t len) {
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) buf[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+void putU32(std::vector<char>& out, uint32_t val) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((char) ((val >> (8 * i)) & 0xFF));
+    }
+}
+
+uint32_t getU32(const char *buf) {
+    uint32_t val = 0;
+    for (int i = 0; i < 4; i++) {
+        val |= (uint32_t) (unsigned char) buf[i] << (8 * i);
+    }
+    return val;
+}
+
+} //namespace
+
+MemoryFilesystemAdapter::MemoryFilesystemAdapter(const char *imagePath, unsigned long snapshotInterval) :
+        imagePath(imagePath ? imagePath : ""), snapshotInterval(snapshotInterval) {
+
+    if (this->imagePath.empty() || !restoreImage()) {
+        seedFromDefaultFilesystem();
+    }
+
+    snapshotRevision = revision;
+    lastSnapshot = mocpp_tick_ms();
+
+    MO_DBG_INFO("RAM filesystem with %zu files, %zu bytes", getNumFiles(), getTotalSize());
+}
+
+MemoryFilesystemAdapter::~MemoryFilesystemAdapter() {
+    snapshot();
+}
+
+const char *MemoryFilesystemAdapter::stripPrefix(const char *path) {
+    if (!strncmp(path, MO_FILENAME_PREFIX, strlen(MO_FILENAME_PREFIX))) {
+        return path + strlen(MO_FILENAME_PREFIX);
+    }
+    return path;
+}
+
+bool MemoryFilesystemAdapter::stat(const char *path, size_t *size) {
+    auto file = files.find(stripPrefix(path));
+    if (file == files.end()) {
+        return false;
+    }
+    *size = file->second->size();
+    return true;
+}
+
+bool MemoryFilesystemAdapter::remove(const char *path) {
+    if (!files.erase(stripPrefix(path))) {
+        return false;
+    }
+    setModified();
+    return true;
+}
+
+bool MemoryFilesystemAdapter::rename(const char *from, const char *to) {
+    auto file = files.find(stripPrefix(from));
+    if (file == files.end()) {
+        return false;
+    }
+    auto data = file->second;
+    files.erase(file);
+    files[stripPrefix(to)] = data;
+    setModified();
+    return true;
+}
+
+int MemoryFilesystemAdapter::ftw_root(std::function<int(const char *fpath)> fn) {
+    //fn may remove the current file, so iterate over a copy of the filenames
+    std::vector<std::string> fnames;
+    fnames.reserve(files.size());
+    for (auto& file : files) {
+        fnames.push_back(file.first);
+    }
+    for (auto& fname : fnames) {
+        int err = fn(fname.c_str());
+        if (err) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+std::unique_ptr<MicroOcpp::FileAdapter> MemoryFilesystemAdapter::open(const char *fn, const char *mode) {
+    std::string fname = stripPrefix(fn);
+    auto file = files.find(fname);
+
+    if (mode[0] == 'r') {
+        if (file == files.end()) {
+            return nullptr;
+        }
+        return std::unique_ptr<MicroOcpp::FileAdapter>(new MemoryFileAdapter(file->second, *this, 0));
+    } else if (mode[0] == 'w') {
+        auto data = std::make_shared<std::vector<char>>();
+        files[fname] = data;
+        setModified();
+        return std::unique_ptr<MicroOcpp::FileAdapter>(new MemoryFileAdapter(data, *this, 0));
+    } else if (mode[0] == 'a') {
+        if (file == files.end()) {
+            file = files.emplace(fname, std::make_shared<std::vector<char>>()).first;
+            setModified();
+        }
+        return std::unique_ptr<MicroOcpp::FileAdapter>(new MemoryFileAdapter(file->second, *this, file->second->size()));
+    }
+
+    MO_DBG_ERR("unsupported mode: %s", mode);
+    return nullptr;
+}
+
+size_t MemoryFilesystemAdapter::getTotalSize() {
+    size_t total = 0;
+    for (auto& file : files) {
+        total += file.second->size();
+    }
+    return total;
+}
+
+void MemoryFilesystemAdapter::loop() {
+    if (imagePath.empty() || mocpp_tick_ms() - lastSnapshot < snapshotInterval) {
+        return;
+    }
+    lastSnapshot = mocpp_tick_ms();
+    snapshot();
+}
+
+bool MemoryFilesystemAdapter::snapshot() {
+    if (imagePath.empty() || revision == snapshotRevision) {
+        return true;
+    }
+
+    std::vector<char> image;
+    image.reserve(MO_SIM_RAMFS_HEADER_SIZE + getTotalSize() + files.size() * 64);
+    image.resize(MO_SIM_RAMFS_HEADER_SIZE);
+
+    putU32(image, (uint32_t) files.size());
+    for (auto& file : files) {
+        image.push_back((char) (file.first.size() & 0xFF));
+        image.push_back((char) ((file.first.size() >> 8) & 0xFF));
+        image.insert(image.end(), file.first.begin(), file.first.end());
+        putU32(image, (uint32_t) file.second->size());
+        image.insert(image.end(), file.second->begin(), file.second->end());
+    }
+
+    size_t payloadLen = image.size() - MO_SIM_RAMFS_HEADER_SIZE;
+    uint32_t checksum = imageChecksum(image.data() + MO_SIM_RAMFS_HEADER_SIZE, payloadLen);
+
+    std::vector<char> header;
+    header.insert(header.end(), MO_SIM_RAMFS_MAGIC, MO_SIM_RAMFS_MAGIC + 4);
+    header.push_back((char) MO_SIM_RAMFS_VERSION);
+    header.resize(8, '\0');
+    putU32(header, (uint32_t) payloadLen);
+    putU32(header, checksum);
+    memcpy(image.data(), header.data(), MO_SIM_RAMFS_HEADER_SIZE);
+
+    std::string tmpPath = imagePath + ".tmp";
+    if (!writeImage(tmpPath.c_str(), image)) {
+        MO_DBG_ERR("snapshot failed: %s", tmpPath.c_str());
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+
+    if (std::rename(tmpPath.c_str(), imagePath.c_str())) {
+        //on Windows, rename doesn't replace an existing file
+        std::remove(imagePath.c_str());
+        if (std::rename(tmpPath.c_str(), imagePath.c_str())) {
+            MO_DBG_ERR("cannot replace %s", imagePath.c_str());
+            return false;
+        }
+    }
+
+    snapshotRevision = revision;
+    MO_DBG_DEBUG("snapshot %s: %zu bytes", imagePath.c_str(), image.size());
+    return true;
+}
+
+#if MO_SIM_RAMFS_MMAP
+
+bool MemoryFilesystemAdapter::writeImage(const char *path, const std::vector<char>& image) {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, (off_t) image.size())) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, image.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    memcpy(map, image.data(), image.size());
+    bool success = !msync(map, image.size(), MS_SYNC); //the image must be complete before it replaces the old one
+    munmap(map, image.size());
+    return success;
+}
+
+bool MemoryFilesystemAdapter::readImage(std::vector<char>& image) {
+    int fd = ::open(imagePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct ::stat st;
+    if (fstat(fd, &st) || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    image.assign((const char*) map, (const char*) map + st.st_size);
+    munmap(map, (size_t) st.st_size);
+    return true;
+}
+
+#else
+
+bool MemoryFilesystemAdapter::writeImage(const char *path, const std::vector<char>& image) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool success = fwrite(image.data(), 1, image.size(), file) == image.size();
+    success &= !fflush(file);
+    success &= !fclose(file);
+    return success;
+}
+
+bool MemoryFilesystemAdapter::readImage(std::vector<char>& image) {
+    FILE *file = fopen(imagePath.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    char buf [4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        image.insert(image.end(), buf, buf + len);
+    }
+    fclose(file);
+    return true;
+}
+
+#endif //MO_SIM_RAMFS_MMAP
+
+bool MemoryFilesystemAdapter::restoreImage() {
+    std::vector<char> image;
+    if (!readImage(image)) {
+        MO_DBG_DEBUG("no image %s", imagePath.c_str());
+        return false;
+    }
+
+    if (image.size() < MO_SIM_RAMFS_HEADER_SIZE ||
+            memcmp(image.data(), MO_SIM_RAMFS_MAGIC, 4) ||
+            image[4] != MO_SIM_RAMFS_VERSION) {
+        MO_DBG_WARN("invalid image %s", imagePath.c_str());
+        return false;
+    }
+
+    size_t payloadLen = getU32(image.data() + 8);
+    if (MO_SIM_RAMFS_HEADER_SIZE + payloadLen > image.size() ||
+            getU32(image.data() + 12) != imageChecksum(image.data() + MO_SIM_RAMFS_HEADER_SIZE, payloadLen)) {
+        MO_DBG_WARN("corrupt image %s", imagePath.c_str());
+        return false;
+    }
+
+    const char *p = image.data() + MO_SIM_RAMFS_HEADER_SIZE;
+    const char *end = p + payloadLen;
+
+    if (end - p < 4) {
+        return false;
+    }
+    uint32_t numFiles = getU32(p);
+    p += 4;
+
+    std::map<std::string, FileData> restored;
+    for (uint32_t i = 0; i < numFiles; i++) {
+        if (end - p < 2) {
+            return false;
+        }
+        size_t nameLen = (size_t) (unsigned char) p[0] | ((size_t) (unsigned char) p[1] << 8);
+        p += 2;
+        if ((size_t) (end - p) < nameLen + 4) {
+            return false;
+        }
+        std::string fname (p, nameLen);
+        p += nameLen;
+        size_t dataLen = getU32(p);
+        p += 4;
+        if ((size_t) (end - p) < dataLen) {
+            return false;
+        }
+        restored[fname] = std::make_shared<std::vector<char>>(p, p + dataLen);
+        p += dataLen;
+    }
+
+    files = std::move(restored);
+    MO_DBG_INFO("restored %zu files from image %s", files.size(), imagePath.c_str());
+    return true;
+}
+
+void MemoryFilesystemAdapter::seedFromDefaultFilesystem() {
+    auto filesystem = MicroOcpp::makeDefaultFilesystemAdapter(MicroOcpp::FilesystemOpt::Use_Mount_FormatOnFail);
+    if (!filesystem) {
+        return;
+    }
+
+    filesystem->ftw_root([this, &filesystem] (const char *fname) -> int {
+        std::string path = MO_FILENAME_PREFIX;
+        path += fname;
+        if (path == imagePath) {
+            return 0;
+        }
+        size_t size = 0;
+        if (!filesystem->stat(path.c_str(), &size)) {
+            return 0;
+        }
+        auto file = filesystem->open(path.c_str(), "r");
+        if (!file) {
+            return 0;
+        }
+        auto data = std::make_shared<std::vector<char>>(size);
+        data->resize(file->read(data->data(), size));
+        files[fname] = data;
+        return 0;
+    });
+
+    setModified();
+}
+
+std::shared_ptr<MemoryFilesystemAdapter> makeMemoryFilesystemAdapter(const char *imagePath, unsigned long snapshotInterval) {
+    return std::make_shared<MemoryFilesystemAdapter>(imagePath, snapshotInterval);
+}
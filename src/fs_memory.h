@@ -0,0 +1,86 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_FS_MEMORY_H
+#define MO_SIM_FS_MEMORY_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+#ifndef MO_SIM_RAMFS
+#define MO_SIM_RAMFS 0 //1: keep mo_store in RAM instead of the host filesystem
+#endif
+
+#ifndef MO_SIM_RAMFS_IMAGE
+#define MO_SIM_RAMFS_IMAGE "./mo_store.img" //image file which backs the RAM filesystem. "" for RAM only
+#endif
+
+#ifndef MO_SIM_RAMFS_SNAPSHOT_INTERVAL
+#define MO_SIM_RAMFS_SNAPSHOT_INTERVAL 10000UL //in ms
+#endif
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define MO_SIM_RAMFS_MMAP 1
+#else
+#define MO_SIM_RAMFS_MMAP 0
+#endif
+
+/*
+ * FilesystemAdapter which keeps all files in RAM. Optionally, the files are snapshotted
+ * periodically into one memory-mapped image file and restored from there at startup. Each
+ * snapshot is written to a temporary file which then replaces the image, so a crash leaves
+ * either the old or the new image. If no valid image exists, the RAM filesystem is seeded
+ * with the files in MO_FILENAME_PREFIX
+ */
+class MemoryFilesystemAdapter : public MicroOcpp::FilesystemAdapter {
+public:
+    using FileData = std::shared_ptr<std::vector<char>>;
+private:
+    std::map<std::string, FileData> files; //key: filename without MO_FILENAME_PREFIX
+
+    std::string imagePath;
+    unsigned long snapshotInterval;
+    unsigned long lastSnapshot = 0;
+    unsigned int revision = 0; //incremented on each modification
+    unsigned int snapshotRevision = 0;
+
+    const char *stripPrefix(const char *path);
+
+    bool writeImage(const char *path, const std::vector<char>& image);
+    bool readImage(std::vector<char>& image);
+    bool restoreImage();
+    void seedFromDefaultFilesystem();
+public:
+    MemoryFilesystemAdapter(const char *imagePath, unsigned long snapshotInterval);
+    ~MemoryFilesystemAdapter();
+
+    bool stat(const char *path, size_t *size) override;
+
+    bool remove(const char *path) override;
+
+    //moves a file, replacing the destination. Not part of the FilesystemAdapter interface
+    bool rename(const char *from, const char *to);
+
+    int ftw_root(std::function<int(const char *fpath)> fn) override;
+
+    std::unique_ptr<MicroOcpp::FileAdapter> open(const char *fn, const char *mode) override;
+
+    void setModified() {revision++;}
+
+    //writes the image file if the periodic snapshot is due
+    void loop();
+
+    //writes the image file if files have been modified since the last snapshot
+    bool snapshot();
+
+    size_t getNumFiles() {return files.size();}
+    size_t getTotalSize();
+};
+
+std::shared_ptr<MemoryFilesystemAdapter> makeMemoryFilesystemAdapter(const char *imagePath = MO_SIM_RAMFS_IMAGE, unsigned long snapshotInterval = MO_SIM_RAMFS_SNAPSHOT_INTERVAL);
+
+#endif
@@ -0,0 +1,508 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "history.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <MicroOcpp/Core/Context.h>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "evse.h"
+#include "profile.h"
+#include "fs_memory.h"
+
+#define MO_SIM_HISTORY_FN MO_FILENAME_PREFIX "sim-history.bin"
+#define MO_SIM_HISTORY_ROTATED_FN MO_SIM_HISTORY_FN ".1"
+#define MO_SIM_HISTORY_MAGIC "MOH"
+#define MO_SIM_HISTORY_HEADER_LEN 4
+#define MO_SIM_HISTORY_TEXT_MAX 64
+
+namespace {
+
+void putVarint(std::string& out, uint64_t val) {
+    while (val >= 0x80) {
+        out.push_back((char) (uint8_t) (val | 0x80));
+        val >>= 7;
+    }
+    out.push_back((char) (uint8_t) val);
+}
+
+void putZigzag(std::string& out, int64_t val) {
+    putVarint(out, ((uint64_t) val << 1) ^ (uint64_t) (val >> 63));
+}
+
+std::string cleanText(const char *text) {
+    std::string out (text, strnlen(text, MO_SIM_HISTORY_TEXT_MAX));
+    for (auto& c : out) {
+        //keep the JSON export free of escaping
+        if (c == '"' || c == '\\' || (unsigned char) c < 0x20) {
+            c = '_';
+        }
+    }
+    return out;
+}
+
+void putText(std::string& out, const std::string& text) {
+    putVarint(out, text.size());
+    out += text;
+}
+
+bool getVarint(const char *data, size_t size, size_t& pos, uint64_t& out) {
+    out = 0;
+    for (unsigned int shift = 0; shift < 64 && pos < size; shift += 7) {
+        uint8_t b = (uint8_t) data[pos++];
+        out |= (uint64_t) (b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool getZigzag(const char *data, size_t size, size_t& pos, int64_t& out) {
+    uint64_t val;
+    if (!getVarint(data, size, pos, val)) {
+        return false;
+    }
+    out = (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+    return true;
+}
+
+bool getText(const char *data, size_t size, size_t& pos, std::string& out) {
+    uint64_t len;
+    if (!getVarint(data, size, pos, len) || len > MO_SIM_HISTORY_TEXT_MAX || len > size - pos) {
+        return false;
+    }
+    out.assign(data + pos, (size_t) len);
+    pos += (size_t) len;
+    return true;
+}
+
+} //namespace
+
+void MeterHistory::declareConfigurations() {
+    intervalInt = MicroOcpp::declareConfiguration<int>("historyInterval", 0, SIMULATOR_FN, false, false, false);
+}
+
+void MeterHistory::setInterval(int interval) {
+    if (!intervalInt || intervalInt->getInt() == interval) return;
+    intervalInt->setInt(interval);
+    MicroOcpp::configuration_save();
+}
+
+void MeterHistory::setup(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem) {
+    this->filesystem = filesystem;
+    fileSize = 0;
+    records = 0;
+    segments = 0;
+    recentCount = 0;
+    lastFlush = mocpp_tick_ms();
+
+    size_t size = 0;
+    if (!filesystem || !filesystem->stat(MO_SIM_HISTORY_FN, &size) || size == 0) {
+        return;
+    }
+
+    std::string content (size, '\0');
+    {
+        auto f = filesystem->open(MO_SIM_HISTORY_FN, "r");
+        if (!f) {
+            return;
+        }
+        content.resize(f->read(&content[0], size));
+    }
+
+    size_t valid = decode(content.data(), content.size(), [this] (const Record& record) {
+        records++;
+        if (record.type == RecordType::Segment) {
+            segments++;
+        }
+        remember(record);
+        return true;
+    });
+
+    if (valid == content.size()) {
+        fileSize = valid;
+        return;
+    }
+
+    if (valid == 0) {
+        MO_DBG_WARN("%s has an unknown format, discard", MO_SIM_HISTORY_FN);
+        filesystem->remove(MO_SIM_HISTORY_FN);
+        return;
+    }
+
+    MO_DBG_WARN("%s has a torn tail, cut off %zu bytes", MO_SIM_HISTORY_FN, content.size() - valid);
+    auto f = filesystem->open(MO_SIM_HISTORY_FN, "w");
+    if (f && f->write(content.data(), valid) == valid) {
+        fileSize = valid;
+    }
+}
+
+void MeterHistory::startSegment() {
+    auto now = mocpp_tick_ms();
+
+    char clock [MicroOcpp::JSONDATE_LENGTH + 1] = {'\0'};
+    auto& time = getOcppContext()->getModel().getClock().now();
+    segmentClockSet = time >= MicroOcpp::MIN_TIME;
+    if (segmentClockSet) {
+        time.toJsonString(clock, sizeof(clock));
+    }
+
+    buf.push_back((char) RecordType::Segment);
+    Record record;
+    record.type = RecordType::Segment;
+    record.text = cleanText(clock);
+
+    putText(buf, record.text);
+    records++;
+    segments++;
+
+    remember(record);
+
+    segmentStarted = true;
+    segmentStart = now;
+    lastRecord = now;
+    for (auto& state : states) {
+        state.energy = 0;
+        state.power = 0;
+        state.recorded = false;
+    }
+}
+
+void MeterHistory::remember(const Record& record) {
+    recent[recentCount % MO_SIM_HISTORY_RECENT] = record;
+    recentCount++;
+}
+
+bool MeterHistory::rotate() {
+    if (!flush()) {
+        buf.clear(); //delta encoded against the old file, so it can't be moved into the new one
+    }
+
+    //the FilesystemAdapter has no rename, so move the file directly in the backing store
+#if MO_SIM_RAMFS
+    bool success = static_cast<MemoryFilesystemAdapter&>(*filesystem).rename(MO_SIM_HISTORY_FN, MO_SIM_HISTORY_ROTATED_FN);
+#else
+    remove(MO_SIM_HISTORY_ROTATED_FN); //rename doesn't replace existing files on Windows
+    bool success = !rename(MO_SIM_HISTORY_FN, MO_SIM_HISTORY_ROTATED_FN);
+#endif
+    if (!success) {
+        MO_DBG_ERR("cannot rotate %s, discard it", MO_SIM_HISTORY_FN);
+        filesystem->remove(MO_SIM_HISTORY_FN);
+    }
+
+    fileSize = 0;
+    records = 0;
+    segments = 0;
+    rotations++;
+    segmentStarted = false; //the new file starts with a new segment, so it can be decoded on its own
+    return success;
+}
+
+void MeterHistory::beginRecord(RecordType type) {
+    if (filesystem && fileSize + buf.size() >= MO_SIM_HISTORY_MAX_SIZE) {
+        rotate();
+    }
+    if (!segmentStarted) {
+        startSegment();
+    }
+    auto now = mocpp_tick_ms();
+    buf.push_back((char) type);
+    putVarint(buf, now - lastRecord);
+    lastRecord = now;
+    records++;
+}
+
+void MeterHistory::loop() {
+    int interval = getInterval();
+    if (!filesystem) {
+        return; //no persistence, e.g. on WASM
+    }
+    if (interval <= 0) {
+        if (!buf.empty()) {
+            flush();
+        }
+        return;
+    }
+
+    auto now = mocpp_tick_ms();
+
+    if (segmentStarted && !segmentClockSet && getOcppContext()->getModel().getClock().now() >= MicroOcpp::MIN_TIME) {
+        startSegment(); //give the following records an absolute time
+    }
+
+    for (unsigned int i = 0; i < connectors.size() && i < states.size(); i++) {
+        auto& evse = connectors[i];
+        auto& state = states[i];
+
+        bool txActive = *evse.getSessionIdTag();
+        if (txActive != state.txActive) {
+            state.txActive = txActive;
+            state.txId = evse.getTransactionId();
+            Record record;
+            record.type = txActive ? RecordType::TxStart : RecordType::TxStop;
+            record.connectorId = evse.getConnectorId();
+            record.txId = state.txId;
+            record.energy = std::max(0, evse.getEnergy());
+            if (txActive) {
+                record.text = cleanText(evse.getSessionIdTag());
+            }
+
+            beginRecord(record.type);
+            putVarint(buf, record.connectorId);
+            putZigzag(buf, record.txId);
+            putVarint(buf, (uint64_t) record.energy);
+            if (txActive) {
+                putText(buf, record.text);
+            }
+            record.time = lastRecord - segmentStart;
+            remember(record);
+        } else if (txActive && state.txId < 0) {
+            state.txId = evse.getTransactionId(); //assigned by the server after TxStart
+        }
+    }
+
+    if (now - lastSample >= (unsigned long) interval * 1000UL) {
+        lastSample = now;
+
+        for (unsigned int i = 0; i < connectors.size() && i < states.size(); i++) {
+            auto& evse = connectors[i];
+            auto& state = states[i];
+
+            int energy = evse.getEnergy();
+            int power = evse.getPower();
+            if (state.recorded && energy == state.energy && power == state.power) {
+                continue; //idle connectors don't take space
+            }
+
+            beginRecord(RecordType::Meter);
+            putVarint(buf, evse.getConnectorId());
+            putZigzag(buf, (int64_t) energy - (int64_t) state.energy);
+            putZigzag(buf, (int64_t) power - (int64_t) state.power);
+            state.energy = energy;
+            state.power = power;
+            state.recorded = true;
+
+            Record record;
+            record.type = RecordType::Meter;
+            record.time = lastRecord - segmentStart;
+            record.connectorId = evse.getConnectorId();
+            record.energy = energy;
+            record.power = power;
+            remember(record);
+        }
+    }
+
+    if (buf.size() >= MO_SIM_HISTORY_FLUSH_SIZE || (!buf.empty() && now - lastFlush >= MO_SIM_HISTORY_FLUSH_INTERVAL)) {
+        flush();
+    }
+}
+
+bool MeterHistory::flush() {
+    lastFlush = mocpp_tick_ms();
+    if (buf.empty() || !filesystem) {
+        return true;
+    }
+
+    ProfileScope scope (LoopPhase::Persistence);
+
+    std::string out;
+    if (fileSize == 0) {
+        out = MO_SIM_HISTORY_MAGIC;
+        out.push_back((char) MO_SIM_HISTORY_VERSION);
+    }
+    out += buf;
+
+    auto f = filesystem->open(MO_SIM_HISTORY_FN, fileSize == 0 ? "w" : "a");
+    if (!f || f->write(out.data(), out.size()) != out.size()) {
+        MO_DBG_ERR("cannot append to %s", MO_SIM_HISTORY_FN);
+        return false;
+    }
+    fileSize += out.size();
+    buf.clear();
+    return true;
+}
+
+size_t MeterHistory::decode(const char *data, size_t size, std::function<bool(const Record&)> onRecord) {
+    if (size < MO_SIM_HISTORY_HEADER_LEN ||
+            memcmp(data, MO_SIM_HISTORY_MAGIC, strlen(MO_SIM_HISTORY_MAGIC)) ||
+            (uint8_t) data[3] != MO_SIM_HISTORY_VERSION) {
+        return 0;
+    }
+
+    std::vector<std::pair<int64_t, int64_t>> meters; //energy and power per connectorId
+    unsigned long time = 0;
+
+    size_t pos = MO_SIM_HISTORY_HEADER_LEN;
+    size_t valid = pos;
+    Record record;
+    while (pos < size) {
+        record.type = (RecordType) data[pos++];
+        record.connectorId = 0;
+        record.txId = -1;
+        record.energy = 0;
+        record.power = 0;
+        record.text.clear();
+
+        if (record.type == RecordType::Segment) {
+            if (!getText(data, size, pos, record.text)) {
+                break;
+            }
+            time = 0;
+            meters.clear();
+        } else if (record.type == RecordType::Meter || record.type == RecordType::TxStart || record.type == RecordType::TxStop) {
+            uint64_t dt, connectorId;
+            if (!getVarint(data, size, pos, dt) || !getVarint(data, size, pos, connectorId) || connectorId > 255) {
+                break;
+            }
+            time += (unsigned long) dt;
+            record.connectorId = (unsigned int) connectorId;
+
+            if (record.type == RecordType::Meter) {
+                int64_t dEnergy, dPower;
+                if (!getZigzag(data, size, pos, dEnergy) || !getZigzag(data, size, pos, dPower)) {
+                    break;
+                }
+                if (meters.size() <= connectorId) {
+                    meters.resize(connectorId + 1, {0, 0});
+                }
+                meters[connectorId].first += dEnergy;
+                meters[connectorId].second += dPower;
+                record.energy = (int) meters[connectorId].first;
+                record.power = (int) meters[connectorId].second;
+            } else {
+                int64_t txId;
+                uint64_t energy;
+                if (!getZigzag(data, size, pos, txId) || !getVarint(data, size, pos, energy)) {
+                    break;
+                }
+                record.txId = (int) txId;
+                record.energy = (int) energy;
+                if (record.type == RecordType::TxStart && !getText(data, size, pos, record.text)) {
+                    break;
+                }
+            }
+        } else {
+            break; //unknown type or torn record
+        }
+        record.time = time;
+        valid = pos;
+
+        if (!onRecord(record)) {
+            break;
+        }
+    }
+
+    return valid;
+}
+
+int MeterHistory::writeRecordJson(const Record& record, char *buf, size_t size) {
+    switch (record.type) {
+        case RecordType::Segment:
+            return snprintf(buf, size, "{\"type\":\"segment\",\"clock\":\"%s\"}", record.text.c_str());
+        case RecordType::Meter:
+            return snprintf(buf, size, "{\"type\":\"meter\",\"t\":%lu,\"connectorId\":%u,\"energy\":%i,\"power\":%i}",
+                    record.time, record.connectorId, record.energy, record.power);
+        case RecordType::TxStart:
+            return snprintf(buf, size, "{\"type\":\"txStart\",\"t\":%lu,\"connectorId\":%u,\"txId\":%i,\"meterStart\":%i,\"idTag\":\"%s\"}",
+                    record.time, record.connectorId, record.txId, record.energy, record.text.c_str());
+        case RecordType::TxStop:
+            return snprintf(buf, size, "{\"type\":\"txStop\",\"t\":%lu,\"connectorId\":%u,\"txId\":%i,\"meterStop\":%i}",
+                    record.time, record.connectorId, record.txId, record.energy);
+    }
+    return -1;
+}
+
+long MeterHistory::exportJson(const char *fn) {
+    if (!filesystem || !flush()) {
+        return -1;
+    }
+
+    auto f = filesystem->open(fn, "w");
+    if (!f) {
+        MO_DBG_ERR("cannot write %s", fn);
+        return -1;
+    }
+
+    long written = 0;
+    bool success = true;
+    std::string out = "[";
+    auto writeOut = [&] () {
+        success &= f->write(out.data(), out.size()) == out.size();
+        written += (long) out.size();
+        out.clear();
+    };
+
+    bool first = true;
+    for (const char *historyFn : {MO_SIM_HISTORY_ROTATED_FN, MO_SIM_HISTORY_FN}) { //oldest first
+        std::string content;
+        size_t size = 0;
+        if (!filesystem->stat(historyFn, &size) || size == 0) {
+            continue;
+        }
+        {
+            auto fIn = filesystem->open(historyFn, "r");
+            if (!fIn) {
+                return -1;
+            }
+            content.resize(size);
+            content.resize(fIn->read(&content[0], size));
+        }
+
+        decode(content.data(), content.size(), [&] (const Record& record) {
+            char line [256];
+            int ret = writeRecordJson(record, line, sizeof(line));
+            if (ret < 0 || (size_t) ret >= sizeof(line)) {
+                return true; //skip
+            }
+            out += first ? "\n" : ",\n";
+            out += line;
+            first = false;
+            if (out.size() >= 4096) {
+                writeOut();
+            }
+            return success;
+        });
+    }
+    out += "\n]\n";
+    writeOut();
+
+    return success ? written : -1;
+}
+
+int MeterHistory::writeJson(char *buf, size_t size, unsigned int limit) {
+    //the last records are kept in memory
+    unsigned long count = std::min((unsigned long) limit, std::min(recentCount, (unsigned long) MO_SIM_HISTORY_RECENT));
+
+    int written = snprintf(buf, size, "{\"interval\":%i,\"fileSize\":%zu,\"maxSize\":%lu,\"rotations\":%lu,\"buffered\":%zu,\"records\":%lu,\"segments\":%lu,\"last\":[",
+            getInterval(), fileSize, (unsigned long) MO_SIM_HISTORY_MAX_SIZE, rotations, this->buf.size(), records, segments);
+
+    for (unsigned long n = recentCount - count; n < recentCount; n++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        if (n > recentCount - count) {
+            written += snprintf(buf + written, size - written, ",");
+        }
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        int ret = writeRecordJson(recent[n % MO_SIM_HISTORY_RECENT], buf + written, size - written);
+        if (ret < 0) {
+            return -1;
+        }
+        written += ret;
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "]}");
+    return written;
+}
@@ -0,0 +1,134 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_HISTORY_H
+#define MO_SIM_HISTORY_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <MicroOcpp/Core/Configuration.h>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+#ifndef MO_SIM_HISTORY_FLUSH_INTERVAL
+#define MO_SIM_HISTORY_FLUSH_INTERVAL 60000 //append the buffered records to the file after this period in ms
+#endif
+
+#ifndef MO_SIM_HISTORY_FLUSH_SIZE
+#define MO_SIM_HISTORY_FLUSH_SIZE 1024 //or once this number of bytes is buffered
+#endif
+
+#ifndef MO_SIM_HISTORY_MAX_SIZE
+#define MO_SIM_HISTORY_MAX_SIZE 1048576 //rotate the file to sim-history.bin.1 once it reaches this size in bytes
+#endif
+
+#ifndef MO_SIM_HISTORY_RECENT
+#define MO_SIM_HISTORY_RECENT 32 //number of the last records which are kept in memory for the API
+#endif
+
+#define MO_SIM_HISTORY_VERSION 1
+
+/*
+ * Compact transaction and meter history of the simulated connectors. The records are appended to
+ * a binary file with varint encoding. Timestamps and meter readings are stored as delta to the
+ * previous record, so a meter record typically takes 5 - 7 bytes. A segment record starts each
+ * run of the Simulator and resets the deltas, so appending doesn't require reading the file.
+ * MicroOcpp's own tx and meter JSON files are left untouched, as MicroOcpp keeps its message
+ * queue in them. MicroOcpp only keeps its latest txs there, so the long-term record is this file
+ *
+ * File format:
+ *     "MOH" <version byte>
+ *     records, each <type byte> <fields>:
+ *     1 Segment:  <len> <ISO 8601 time of the OCPP clock, empty if not set yet>
+ *     2 Meter:    <dt> <connectorId> <zigzag dEnergy Wh> <zigzag dPower W>
+ *     3 TxStart:  <dt> <connectorId> <zigzag txId> <meterStart Wh> <len> <idTag>
+ *     4 TxStop:   <dt> <connectorId> <zigzag txId> <meterStop Wh>
+ * dt is the time in ms since the previous record of the segment. A torn last record is cut off
+ * at startup. Once the file reaches MO_SIM_HISTORY_MAX_SIZE, it is moved to sim-history.bin.1,
+ * replacing the previous one, and a new file with a new segment is started. The last records
+ * are also kept in memory, so the status doesn't need to read the file
+ */
+class MeterHistory {
+public:
+    enum class RecordType : uint8_t {
+        Segment = 1,
+        Meter,
+        TxStart,
+        TxStop
+    };
+
+    struct Record {
+        RecordType type;
+        unsigned long time = 0; //in ms since segment start
+        unsigned int connectorId = 0;
+        int txId = -1;
+        int energy = 0;
+        int power = 0;
+        std::string text; //Segment: clock, TxStart: idTag
+    };
+private:
+    std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem;
+    std::shared_ptr<MicroOcpp::Configuration> intervalInt; //in s, 0 disables the history
+
+    std::string buf; //records which haven't been flushed yet
+    size_t fileSize = 0;
+    unsigned long rotations = 0;
+
+    std::array<Record, MO_SIM_HISTORY_RECENT> recent; //ring buffer, record n at index n % MO_SIM_HISTORY_RECENT
+    unsigned long recentCount = 0;
+    void remember(const Record& record);
+    unsigned long records = 0;
+    unsigned long segments = 0;
+    unsigned long lastFlush = 0;
+
+    //delta encoding state of the current segment
+    bool segmentStarted = false;
+    bool segmentClockSet = false;
+    unsigned long segmentStart = 0;
+    unsigned long lastRecord = 0;
+    struct ConnectorState {
+        int energy = 0;
+        int power = 0;
+        bool recorded = false; //energy and power have been written in this segment
+        bool txActive = false;
+        int txId = -1;
+    };
+    std::array<ConnectorState, MO_NUMCONNECTORS - 1> states;
+    unsigned long lastSample = 0;
+
+    void beginRecord(RecordType type);
+    void startSegment();
+    bool rotate();
+public:
+    //declare the settings. Must be called before loading SIMULATOR_FN
+    void declareConfigurations();
+
+    //checks the history file and cuts off a torn tail
+    void setup(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem);
+
+    void loop();
+
+    //appends the buffered records to the file
+    bool flush();
+
+    int getInterval() {return intervalInt ? intervalInt->getInt() : 0;}
+    void setInterval(int interval);
+
+    //decodes a history file. Returns the number of valid bytes. The callback can return false to stop
+    static size_t decode(const char *data, size_t size, std::function<bool(const Record&)> onRecord);
+
+    static int writeRecordJson(const Record& record, char *buf, size_t size);
+
+    //converts the rotated and the current history file into a JSON array of records. Returns the size of the JSON file or -1
+    long exportJson(const char *fn);
+
+    //status and the last limit records, at most MO_SIM_HISTORY_RECENT
+    int writeJson(char *buf, size_t size, unsigned int limit);
+};
+
+extern MeterHistory meterHistory;
+
+#endif
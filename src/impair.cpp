@@ -0,0 +1,161 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "impair.h"
+
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "evse.h"
+
+void NetImpairment::declareConfigurations() {
+    latencyInt = MicroOcpp::declareConfiguration<int>("netLatency", 0, SIMULATOR_FN, false, false, false);
+    jitterInt = MicroOcpp::declareConfiguration<int>("netJitter", 0, SIMULATOR_FN, false, false, false);
+    bandwidthInt = MicroOcpp::declareConfiguration<int>("netBandwidth", 0, SIMULATOR_FN, false, false, false);
+    lossInt = MicroOcpp::declareConfiguration<int>("netLoss", 0, SIMULATOR_FN, false, false, false);
+    reorderBool = MicroOcpp::declareConfiguration<bool>("netReorder", false, SIMULATOR_FN, false, false, false);
+}
+
+bool NetImpairment::update(int latency, int jitter, int bandwidth, int loss, int reorder) {
+    if (!latencyInt || !jitterInt || !bandwidthInt || !lossInt || !reorderBool) {
+        return false;
+    }
+
+    bool changed = false;
+    auto updateInt = [&changed] (std::shared_ptr<MicroOcpp::Configuration>& config, int val) {
+        if (val >= 0 && val != config->getInt()) {
+            config->setInt(val);
+            changed = true;
+        }
+    };
+    updateInt(latencyInt, latency);
+    updateInt(jitterInt, jitter);
+    updateInt(bandwidthInt, bandwidth);
+    updateInt(lossInt, loss > 1000 ? 1000 : loss);
+    if (reorder >= 0 && (reorder != 0) != reorderBool->getBool()) {
+        reorderBool->setBool(reorder != 0);
+        changed = true;
+    }
+
+    if (changed) {
+        MicroOcpp::configuration_save();
+    }
+    return changed;
+}
+
+ImpairedConnection::ImpairedConnection(MicroOcpp::Connection& connection, NetImpairment& settings, std::function<bool()> isConnected) :
+        connection(connection), settings(settings), isConnected(isConnected) {
+    receiveTXTwrapper = [this] (const char *msg, size_t length) -> bool {
+        if (!this->settings.isActive() && queue.empty()) {
+            return receiveTXT ? receiveTXT(msg, length) : false;
+        }
+        return enqueue(msg, length, false);
+    };
+}
+
+uint32_t ImpairedConnection::random() {
+    //xorshift32
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+bool ImpairedConnection::enqueue(const char *msg, size_t length, bool outgoing) {
+    if (queue.size() >= MO_SIM_NET_QUEUE_MAX) {
+        dropped++;
+        return false;
+    }
+
+    auto now = mocpp_tick_ms();
+    int dir = outgoing ? 1 : 0;
+
+    unsigned long sent = now;
+    if (settings.getBandwidth() > 0) {
+        //the link transmits one frame after the other
+        if ((long) (linkFree[dir] - now) > 0) {
+            sent = linkFree[dir];
+        }
+        sent += (unsigned long) ((uint64_t) length * 1000U / (uint64_t) settings.getBandwidth());
+        linkFree[dir] = sent;
+    }
+
+    unsigned long due = sent + (unsigned long) settings.getLatency();
+    if (settings.getJitter() > 0) {
+        due += random() % ((uint32_t) settings.getJitter() + 1U);
+    }
+    if (settings.getLoss() > 0 && (int) (random() % 1000U) < settings.getLoss()) {
+        due += MO_SIM_NET_LOSS_STALL_MS;
+        stalls++;
+    }
+    if (!settings.getReorder() && (long) (lastDue[dir] - due) > 0) {
+        due = lastDue[dir]; //a stalled frame holds back the following frames like on a TCP stream
+    }
+    lastDue[dir] = due;
+
+    size_t buf;
+    if (!freeBufs.empty()) {
+        buf = freeBufs.back();
+        freeBufs.pop_back();
+    } else {
+        buf = bufs.size();
+        bufs.emplace_back();
+    }
+    bufs[buf].assign(msg, length);
+
+    queue.push(Frame {due, seq++, buf, outgoing});
+    return true;
+}
+
+void ImpairedConnection::loop() {
+    connection.loop();
+
+    auto now = mocpp_tick_ms();
+    while (!queue.empty() && (long) (now - queue.top().due) >= 0) {
+        auto frame = queue.top();
+        queue.pop();
+
+        //the receive callback may enqueue further frames, so move the message out of the pool first
+        std::string msg;
+        msg.swap(bufs[frame.buf]);
+        freeBufs.push_back(frame.buf);
+
+        if (frame.outgoing) {
+            if (!connection.sendTXT(msg.c_str(), msg.size())) {
+                MO_DBG_DEBUG("drop delayed frame");
+                dropped++;
+            }
+        } else if (receiveTXT) {
+            receiveTXT(msg.c_str(), msg.size());
+        }
+
+        if (bufs[frame.buf].empty()) {
+            bufs[frame.buf].swap(msg); //keep the capacity for the next frame
+            bufs[frame.buf].clear();
+        }
+    }
+}
+
+bool ImpairedConnection::sendTXT(const char *msg, size_t length) {
+    if (isConnected && !isConnected()) {
+        return false;
+    }
+    if (!settings.isActive() && queue.empty()) {
+        return connection.sendTXT(msg, length);
+    }
+    return enqueue(msg, length, true);
+}
+
+void ImpairedConnection::setReceiveTXTcallback(MicroOcpp::ReceiveTXTcallback &receiveTXT) {
+    this->receiveTXT = receiveTXT;
+    connection.setReceiveTXTcallback(receiveTXTwrapper);
+}
+
+unsigned long ImpairedConnection::getLastRecv() {
+    return connection.getLastRecv();
+}
+
+unsigned long ImpairedConnection::getLastConnected() {
+    return connection.getLastConnected();
+}
@@ -0,0 +1,113 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_IMPAIR_H
+#define MO_SIM_IMPAIR_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include <MicroOcpp/Core/Connection.h>
+#include <MicroOcpp/Core/Configuration.h>
+
+#ifndef MO_SIM_NET_LOSS_STALL_MS
+#define MO_SIM_NET_LOSS_STALL_MS 1000 //stall of a lost frame until its retransmission
+#endif
+
+#ifndef MO_SIM_NET_QUEUE_MAX
+#define MO_SIM_NET_QUEUE_MAX 10000 //maximum number of delayed frames
+#endif
+
+/*
+ * Link impairment settings, stored in simulator.jsn. All zero disables the impairment
+ */
+class NetImpairment {
+private:
+    std::shared_ptr<MicroOcpp::Configuration> latencyInt; //one-way delay in ms
+    std::shared_ptr<MicroOcpp::Configuration> jitterInt; //additional random delay 0 - jitter in ms
+    std::shared_ptr<MicroOcpp::Configuration> bandwidthInt; //in bytes/s per direction, 0 for unlimited
+    std::shared_ptr<MicroOcpp::Configuration> lossInt; //frames in 1000 which stall for MO_SIM_NET_LOSS_STALL_MS
+    std::shared_ptr<MicroOcpp::Configuration> reorderBool; //let jitter reorder frames
+public:
+    //declare the settings. Must be called before loading SIMULATOR_FN
+    void declareConfigurations();
+
+    int getLatency() {return latencyInt ? latencyInt->getInt() : 0;}
+    int getJitter() {return jitterInt ? jitterInt->getInt() : 0;}
+    int getBandwidth() {return bandwidthInt ? bandwidthInt->getInt() : 0;}
+    int getLoss() {return lossInt ? lossInt->getInt() : 0;}
+    bool getReorder() {return reorderBool ? reorderBool->getBool() : false;}
+
+    bool isActive() {return getLatency() > 0 || getJitter() > 0 || getBandwidth() > 0 || getLoss() > 0;}
+
+    //negative values keep the current setting. Returns true if any setting changed
+    bool update(int latency, int jitter, int bandwidth, int loss, int reorder);
+};
+
+extern NetImpairment netImpairment;
+
+/*
+ * Connection decorator which delays the frames in both directions according to NetImpairment.
+ * Delayed frames wait in a priority queue ordered by their due time, so each frame costs
+ * O(log n) and the frame buffers are reused
+ */
+class ImpairedConnection : public MicroOcpp::Connection {
+private:
+    MicroOcpp::Connection& connection;
+    NetImpairment& settings;
+    std::function<bool()> isConnected; //state of the inner socket. Connection doesn't expose it
+    MicroOcpp::ReceiveTXTcallback receiveTXT;
+    MicroOcpp::ReceiveTXTcallback receiveTXTwrapper;
+
+    struct Frame {
+        unsigned long due;
+        unsigned long seq; //FIFO order for frames with the same due time
+        size_t buf; //index in bufs
+        bool outgoing;
+    };
+    struct FrameLater {
+        bool operator()(const Frame& a, const Frame& b) const {
+            return (long) (a.due - b.due) > 0 || (a.due == b.due && a.seq > b.seq);
+        }
+    };
+    std::priority_queue<Frame, std::vector<Frame>, FrameLater> queue;
+    std::vector<std::string> bufs;
+    std::vector<size_t> freeBufs;
+    unsigned long seq = 0;
+
+    unsigned long lastDue [2] = {0, 0}; //per direction, 0: incoming, 1: outgoing
+    unsigned long linkFree [2] = {0, 0}; //time when the link has transmitted the previous frame
+
+    uint32_t rng = 88675123U;
+    uint32_t random();
+
+    unsigned long dropped = 0, stalls = 0;
+
+    bool enqueue(const char *msg, size_t length, bool outgoing);
+public:
+    //isConnected reports if the inner socket is open. nullptr treats the socket as always open
+    ImpairedConnection(MicroOcpp::Connection& connection, NetImpairment& settings, std::function<bool()> isConnected = nullptr);
+
+    void loop() override;
+
+    //like the inner connection, fails while the socket is closed so that MicroOcpp keeps the message
+    bool sendTXT(const char *msg, size_t length) override;
+
+    void setReceiveTXTcallback(MicroOcpp::ReceiveTXTcallback &receiveTXT) override;
+
+    unsigned long getLastRecv() override;
+
+    unsigned long getLastConnected() override;
+
+    size_t getQueued() {return queue.size();}
+    unsigned long getDropped() {return dropped;}
+    unsigned long getStalls() {return stalls;}
+};
+
+extern ImpairedConnection *impairedConnection; //nullptr until the connection is set up
+
+#endif
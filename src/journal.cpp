@@ -0,0 +1,294 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "journal.h"
+
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <MicroOcpp/Debug.h>
+
+#include "profile.h"
+
+#define MO_SIM_JOURNAL_HEADER "#MOJNL "
+#define MO_SIM_JOURNAL_SNAPSHOT "#SNAPSHOT"
+
+namespace {
+
+uint32_t crc32(const char *buf, size_t len) {
+    uint32_t crc = 0xFFFFFFFFU;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (unsigned char) buf[i];
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+        }
+    }
+    return ~crc;
+}
+
+//parses "<payload>*<crc>" and returns the payload length, or -1 if the checksum doesn't match
+int verifyLine(const char *line, size_t len) {
+    const char *sep = nullptr;
+    for (size_t i = len; i > 0; i--) {
+        if (line[i - 1] == '*') {
+            sep = line + i - 1;
+            break;
+        }
+    }
+    if (!sep) {
+        return -1;
+    }
+    char *end = nullptr;
+    unsigned long crc = strtoul(sep + 1, &end, 16);
+    if (end != line + len || end == sep + 1) {
+        return -1;
+    }
+    if ((uint32_t) crc != crc32(line, sep - line)) {
+        return -1;
+    }
+    return (int) (sep - line);
+}
+
+} //namespace
+
+void StateJournal::setup(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem, const char *fnBase) {
+    this->filesystem = filesystem;
+    this->fnBase = fnBase;
+}
+
+std::string StateJournal::getFn(unsigned int file) {
+    std::string fn = fnBase;
+    fn += file ? "-b.jnl" : "-a.jnl";
+    return fn;
+}
+
+bool StateJournal::appendLine(std::string& buf, const char *line) {
+    if (strchr(line, '\n')) {
+        MO_DBG_ERR("invalid record");
+        return false;
+    }
+    char crc [12];
+    snprintf(crc, sizeof(crc), "*%08lx\n", (unsigned long) crc32(line, strlen(line)));
+    buf += line;
+    buf += crc;
+    return true;
+}
+
+bool StateJournal::replay(unsigned int file, unsigned int& generationOut, std::map<std::string, std::string>& stateOut, bool& tornOut) {
+    auto fn = getFn(file);
+    size_t size = 0;
+    if (!filesystem->stat(fn.c_str(), &size)) {
+        return false;
+    }
+    auto f = filesystem->open(fn.c_str(), "r");
+    if (!f) {
+        return false;
+    }
+    std::string content (size, '\0');
+    content.resize(f->read(&content[0], size));
+    f.reset();
+
+    bool header = false, snapshot = false;
+    tornOut = false;
+
+    size_t pos = 0;
+    while (pos < content.size()) {
+        size_t eol = content.find('\n', pos);
+        if (eol == std::string::npos) {
+            tornOut = true; //last write has been interrupted
+            break;
+        }
+        const char *line = content.c_str() + pos;
+        size_t lineLen = eol - pos;
+        pos = eol + 1;
+
+        int payloadLen = verifyLine(line, lineLen);
+        if (payloadLen < 0) {
+            tornOut = true;
+            break;
+        }
+        std::string payload (line, (size_t) payloadLen);
+
+        if (!header) {
+            if (payload.compare(0, strlen(MO_SIM_JOURNAL_HEADER), MO_SIM_JOURNAL_HEADER)) {
+                return false;
+            }
+            generationOut = (unsigned int) strtoul(payload.c_str() + strlen(MO_SIM_JOURNAL_HEADER), nullptr, 10);
+            header = true;
+            continue;
+        }
+
+        if (!snapshot && payload == MO_SIM_JOURNAL_SNAPSHOT) {
+            snapshot = true;
+            continue;
+        }
+
+        size_t eq = payload.find('=');
+        if (eq == std::string::npos) {
+            tornOut = true;
+            break;
+        }
+        stateOut[payload.substr(0, eq)] = payload.substr(eq + 1);
+    }
+
+    //a file without complete snapshot is the remainder of an interrupted compaction
+    return header && snapshot;
+}
+
+bool StateJournal::load() {
+    if (!filesystem) {
+        return true;
+    }
+
+    bool valid [2] = {false, false};
+    unsigned int generations [2] = {0, 0};
+    std::map<std::string, std::string> states [2];
+    bool torn [2] = {false, false};
+
+    for (unsigned int i = 0; i < 2; i++) {
+        valid[i] = replay(i, generations[i], states[i], torn[i]);
+    }
+
+    if (!valid[0] && !valid[1]) {
+        MO_DBG_DEBUG("no journal %s, initialize", fnBase.c_str());
+        generation = 0;
+        activeFile = 1;
+        return compact();
+    }
+
+    unsigned int file = (valid[0] && valid[1]) ?
+            (generations[0] > generations[1] ? 0 : 1) :
+            (valid[0] ? 0 : 1);
+
+    state = std::move(states[file]);
+    generation = generations[file];
+    activeFile = file;
+    appendedRecords = 0;
+
+    MO_DBG_DEBUG("recovered %zu records from journal %s", state.size(), getFn(file).c_str());
+
+    size_t size;
+    if (torn[file]) {
+        MO_DBG_WARN("journal %s has a corrupt tail, compact", getFn(file).c_str());
+        return compact();
+    } else if (filesystem->stat(getFn(!file).c_str(), &size)) {
+        filesystem->remove(getFn(!file).c_str()); //outdated or incomplete compaction
+    }
+    return true;
+}
+
+bool StateJournal::compact() {
+    if (!filesystem) {
+        return true;
+    }
+
+    ProfileScope scope (LoopPhase::Persistence);
+
+    unsigned int nextFile = activeFile ? 0 : 1;
+    unsigned int nextGeneration = generation + 1;
+
+    std::string buf;
+    char header [32];
+    snprintf(header, sizeof(header), MO_SIM_JOURNAL_HEADER "%u", nextGeneration);
+    appendLine(buf, header);
+    for (auto& entry : state) {
+        std::string record = entry.first + "=" + entry.second;
+        appendLine(buf, record.c_str());
+    }
+    appendLine(buf, MO_SIM_JOURNAL_SNAPSHOT);
+
+    auto fn = getFn(nextFile);
+    {
+        auto f = filesystem->open(fn.c_str(), "w");
+        if (!f || f->write(buf.c_str(), buf.size()) != buf.size()) {
+            MO_DBG_ERR("cannot write %s", fn.c_str());
+            return false;
+        }
+    } //close file before removing the old one
+
+    size_t size;
+    if (filesystem->stat(getFn(activeFile).c_str(), &size)) {
+        filesystem->remove(getFn(activeFile).c_str());
+    }
+
+    activeFile = nextFile;
+    generation = nextGeneration;
+    appendedRecords = 0;
+    return true;
+}
+
+bool StateJournal::set(const char *key, const char *value) {
+    if (!key || !*key || strchr(key, '=') || !value) {
+        MO_DBG_ERR("invalid argument");
+        return false;
+    }
+
+    auto entry = state.find(key);
+    if (entry != state.end() && entry->second == value) {
+        return true; //no change
+    }
+    state[key] = value;
+
+    if (!filesystem) {
+        return true;
+    }
+
+    ProfileScope scope (LoopPhase::Persistence);
+
+    std::string buf;
+    std::string record = key;
+    record += "=";
+    record += value;
+    if (!appendLine(buf, record.c_str())) {
+        return false;
+    }
+
+    auto fn = getFn(activeFile);
+    auto f = filesystem->open(fn.c_str(), "a");
+    if (!f || f->write(buf.c_str(), buf.size()) != buf.size()) {
+        MO_DBG_ERR("cannot append to %s", fn.c_str());
+        return false;
+    }
+    f.reset();
+
+    appendedRecords++;
+    if (appendedRecords >= MO_SIM_JOURNAL_COMPACT_THRESHOLD) {
+        return compact();
+    }
+    return true;
+}
+
+bool StateJournal::setBool(const char *key, bool value) {
+    return set(key, value ? "true" : "false");
+}
+
+bool StateJournal::setInt(const char *key, int value) {
+    char buf [16];
+    snprintf(buf, sizeof(buf), "%i", value);
+    return set(key, buf);
+}
+
+const char *StateJournal::get(const char *key) {
+    auto entry = state.find(key);
+    return entry != state.end() ? entry->second.c_str() : nullptr;
+}
+
+bool StateJournal::getBool(const char *key, bool& out) {
+    auto value = get(key);
+    if (!value) {
+        return false;
+    }
+    out = !strcmp(value, "true");
+    return true;
+}
+
+bool StateJournal::getInt(const char *key, int& out) {
+    auto value = get(key);
+    if (!value) {
+        return false;
+    }
+    out = (int) strtol(value, nullptr, 10);
+    return true;
+}
@@ -0,0 +1,69 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_JOURNAL_H
+#define MO_SIM_JOURNAL_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+#ifndef MO_SIM_JOURNAL_COMPACT_THRESHOLD
+#define MO_SIM_JOURNAL_COMPACT_THRESHOLD 256 //compact journal after this number of appended records
+#endif
+
+/*
+ * Append-only key-value journal for the simulator state. Each change appends one
+ * checksummed line to the active journal file. After MO_SIM_JOURNAL_COMPACT_THRESHOLD
+ * changes, the current state is written as snapshot into the other of two journal files
+ * with a higher generation number and the old file is removed. At startup, the valid
+ * file with the highest generation is replayed until the first corrupt record, so a
+ * torn write loses at most the last change
+ *
+ * File format (one record per line, <crc> is the CRC-32 of the preceding characters):
+ *     #MOJNL <generation>*<crc>
+ *     <key>=<value>*<crc>         (snapshot of the state at compaction)
+ *     #SNAPSHOT*<crc>
+ *     <key>=<value>*<crc>         (appended changes)
+ */
+class StateJournal {
+private:
+    std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem;
+    std::string fnBase;
+
+    std::map<std::string, std::string> state;
+
+    unsigned int generation = 0;
+    unsigned int activeFile = 0; //0 or 1
+    unsigned int appendedRecords = 0;
+
+    std::string getFn(unsigned int file);
+    bool appendLine(std::string& buf, const char *line);
+    bool replay(unsigned int file, unsigned int& generationOut, std::map<std::string, std::string>& stateOut, bool& tornOut);
+public:
+    //fnBase: path without file ending, e.g. MO_FILENAME_PREFIX "sim-state"
+    void setup(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem, const char *fnBase);
+
+    //recovers the state from the journal files
+    bool load();
+
+    //writes the current state into a fresh journal file
+    bool compact();
+
+    bool set(const char *key, const char *value);
+    bool setBool(const char *key, bool value);
+    bool setInt(const char *key, int value);
+
+    //returns nullptr if key doesn't exist
+    const char *get(const char *key);
+    bool getBool(const char *key, bool& out);
+    bool getInt(const char *key, int& out);
+
+    size_t size() {return state.size();}
+};
+
+extern StateJournal stateJournal;
+
+#endif
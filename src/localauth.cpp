@@ -0,0 +1,216 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "localauth.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <MicroOcpp/Core/Context.h>
+#include <MicroOcpp/Core/Memory.h>
+#include <MicroOcpp/Model/Authorization/AuthorizationService.h>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "profile.h"
+
+#define MO_SIM_LOCALAUTH_FN MO_FILENAME_PREFIX "localauth.jsn"
+
+namespace {
+
+uint64_t nowNs() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//bytes in use on the heap. Returns false if the C library can't report it
+bool getLiveHeap(size_t& out) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    out = mallinfo2().uordblks;
+    return true;
+#else
+    (void) out;
+    return false;
+#endif
+}
+
+MicroOcpp::AuthorizationService *getAuthService() {
+    auto context = getOcppContext();
+    if (!context || context->getVersion().major != 1) {
+        return nullptr;
+    }
+    return context->getModel().getAuthorizationService();
+}
+
+LocalAuthBench::Latency timeLookups(MicroOcpp::AuthorizationService *authService, const std::vector<std::string>& idTags, bool expectFound) {
+    std::vector<uint32_t> samples;
+    samples.reserve(idTags.size());
+    uint64_t sum = 0;
+    for (auto& idTag : idTags) {
+        auto start = nowNs();
+        auto entry = authService->getLocalAuthorization(idTag.c_str());
+        auto t = (uint32_t) std::min(nowNs() - start, (uint64_t) UINT32_MAX);
+        if ((entry != nullptr) != expectFound) {
+            MO_DBG_WARN("unexpected lookup result for %s", idTag.c_str());
+        }
+        samples.push_back(t);
+        sum += t;
+    }
+
+    LocalAuthBench::Latency latency;
+    if (samples.empty()) {
+        return latency;
+    }
+    std::sort(samples.begin(), samples.end());
+    latency.avg = (uint32_t) (sum / samples.size());
+    latency.p50 = samples[samples.size() / 2];
+    latency.p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    latency.max = samples.back();
+    return latency;
+}
+
+} //namespace
+
+void LocalAuthBench::setup(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem) {
+    this->filesystem = filesystem;
+}
+
+bool LocalAuthBench::run(unsigned int entries, unsigned int lookups) {
+    auto authService = getAuthService();
+    if (!authService) {
+        MO_DBG_ERR("local list requires OCPP 1.6");
+        return false;
+    }
+
+    done = true;
+    success = false;
+    this->entries = entries;
+    this->lookups = lookups;
+    hit = Latency();
+    miss = Latency();
+    heapMeasured = false;
+    heapBytes = 0;
+
+    auto t0 = mocpp_tick_ms();
+
+    //the JSON document references the idTags, so they must outlive it
+    std::vector<std::string> idTags (entries);
+    char idTag [32];
+    for (unsigned int i = 0; i < entries; i++) {
+        snprintf(idTag, sizeof(idTag), "SIMLL%09u", i);
+        idTags[i] = idTag;
+    }
+
+    size_t capacity = JSON_ARRAY_SIZE(entries) + entries * (JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(1));
+    auto doc = MicroOcpp::makeJsonDoc("Simulator", capacity);
+    if (!doc || doc->capacity() < capacity) {
+        MO_DBG_ERR("OOM");
+        return false;
+    }
+    JsonArray list = doc->to<JsonArray>();
+    for (auto& id : idTags) {
+        JsonObject entry = list.createNestedObject();
+        entry["idTag"] = id.c_str();
+        entry["idTagInfo"]["status"] = "Accepted";
+    }
+    if (doc->overflowed()) {
+        MO_DBG_ERR("OOM");
+        return false;
+    }
+
+    auto t1 = mocpp_tick_ms();
+    buildTime = t1 - t0;
+
+    unsigned long allocsBefore = profiler.getAllocs();
+    uint64_t allocBytesBefore = profiler.getAllocBytes();
+    size_t heapBefore = 0;
+    bool heapBeforeValid = getLiveHeap(heapBefore);
+
+    listVersion = authService->getLocalListVersion() + 1;
+    if (!authService->updateLocalList(list, listVersion, false)) {
+        MO_DBG_ERR("list rejected. Is MO_LocalAuthListMaxLength large enough?");
+        updateTime = mocpp_tick_ms() - t1;
+        return false;
+    }
+
+    updateTime = mocpp_tick_ms() - t1;
+    allocs = profiler.getAllocs() - allocsBefore;
+    allocBytes = profiler.getAllocBytes() - allocBytesBefore;
+    size_t heapAfter = 0;
+    heapMeasured = heapBeforeValid && getLiveHeap(heapAfter);
+    heapBytes = heapMeasured ? (int64_t) heapAfter - (int64_t) heapBefore : 0;
+    listSize = authService->getLocalListSize();
+
+    fileSize = 0;
+    if (filesystem) {
+        filesystem->stat(MO_SIM_LOCALAUTH_FN, &fileSize);
+    }
+
+    doc.reset();
+
+    //draw the lookups uniformly from the list, and the same number of unknown tokens
+    if (entries > 0) {
+        std::vector<std::string> cached (lookups), uncached (lookups);
+        uint32_t rng = 88675123U;
+        for (unsigned int i = 0; i < lookups; i++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            cached[i] = idTags[rng % entries];
+            snprintf(idTag, sizeof(idTag), "SIMXX%09u", rng % entries);
+            uncached[i] = idTag;
+        }
+        hit = timeLookups(authService, cached, true);
+        miss = timeLookups(authService, uncached, false);
+    }
+
+    MO_DBG_INFO("local list with %zu entries applied in %lu ms, lookup hit %u ns, miss %u ns",
+            listSize, updateTime, hit.avg, miss.avg);
+
+    success = true;
+    return true;
+}
+
+bool LocalAuthBench::clear() {
+    auto authService = getAuthService();
+    if (!authService) {
+        return false;
+    }
+    auto doc = MicroOcpp::makeJsonDoc("Simulator", JSON_ARRAY_SIZE(0));
+    if (!doc) {
+        return false;
+    }
+    return authService->updateLocalList(doc->to<JsonArray>(), authService->getLocalListVersion() + 1, false);
+}
+
+int LocalAuthBench::writeJson(char *buf, size_t size) {
+    if (!done) {
+        return snprintf(buf, size, "{\"done\":false}");
+    }
+    char heap [48];
+    if (heapMeasured) {
+        snprintf(heap, sizeof(heap), "%lld,\"bytesPerEntry\":%.1f",
+                (long long) heapBytes, listSize ? (double) heapBytes / (double) listSize : 0.);
+    } else {
+        snprintf(heap, sizeof(heap), "null,\"bytesPerEntry\":null");
+    }
+    char churn [64];
+#if MO_SIM_PROFILE_ALLOC
+    snprintf(churn, sizeof(churn), "{\"allocs\":%lu,\"allocBytes\":%llu}", allocs, (unsigned long long) allocBytes);
+#else
+    snprintf(churn, sizeof(churn), "null"); //the profiler doesn't count allocations
+#endif
+    return snprintf(buf, size,
+            "{\"done\":true,\"success\":%s,\"entries\":%u,\"listSize\":%zu,\"listVersion\":%i,\"buildTime\":%lu,\"updateTime\":%lu,"
+            "\"heapBytes\":%s,\"churn\":%s,\"fileSize\":%zu,\"lookups\":%u,"
+            "\"hit\":{\"avg\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u},\"miss\":{\"avg\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u}}",
+            success ? "true" : "false", entries, listSize, listVersion, buildTime, updateTime,
+            heap, churn, fileSize, lookups,
+            hit.avg, hit.p50, hit.p99, hit.max, miss.avg, miss.p50, miss.p99, miss.max);
+}
@@ -0,0 +1,65 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_LOCALAUTH_H
+#define MO_SIM_LOCALAUTH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+#ifndef MO_SIM_LOCALAUTH_LOOKUPS
+#define MO_SIM_LOCALAUTH_LOOKUPS 10000 //default number of timed lookups per token kind
+#endif
+
+/*
+ * Local Authorization List benchmark. Generates a list with the given number of entries, applies
+ * it like a SendLocalList from the server, and times the lookups which presentNfcTag performs
+ * when it checks an idTag against the local list. Half of the lookups hit listed tokens and half
+ * miss. The benchmark runs synchronously, so the main loop is blocked while it runs. OCPP 1.6 only
+ *
+ * The memory footprint of the list is the growth of the live heap, which is only available with
+ * glibc (mallinfo2). The allocation counts of the profiler are reported as churn
+ */
+class LocalAuthBench {
+public:
+    struct Latency {
+        uint32_t avg = 0; //in ns
+        uint32_t p50 = 0;
+        uint32_t p99 = 0;
+        uint32_t max = 0;
+    };
+private:
+    std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem;
+
+    bool done = false;
+    bool success = false;
+    unsigned int entries = 0;
+    unsigned int lookups = 0;
+    int listVersion = 0;
+    size_t listSize = 0; //as reported by MicroOcpp after the update
+    unsigned long buildTime = 0; //in ms, creating the SendLocalList payload
+    unsigned long updateTime = 0; //in ms, applying and storing the list
+    uint64_t allocBytes = 0; //churn: all allocations while applying the list, including the freed ones
+    unsigned long allocs = 0;
+    bool heapMeasured = false;
+    int64_t heapBytes = 0; //growth of the live heap by applying the list
+    size_t fileSize = 0; //persisted list
+    Latency hit, miss;
+public:
+    void setup(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem);
+
+    //replaces the local list with a list of the given size and measures it
+    bool run(unsigned int entries, unsigned int lookups);
+
+    //clears the local list
+    bool clear();
+
+    int writeJson(char *buf, size_t size);
+};
+
+extern LocalAuthBench localAuthBench;
+
+#endif
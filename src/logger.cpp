@@ -0,0 +1,236 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "logger.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <MicroOcpp/Platform.h>
+
+const char *cstrFromLogCategory(LogCategory category) {
+    switch (category) {
+        case LogCategory::Traffic:
+            return "traffic";
+        case LogCategory::Ocpp:
+            return "ocpp";
+        default:
+            break;
+    }
+    return "";
+}
+
+bool parseLogCategory(const char *cstr, LogCategory& out) {
+    for (size_t i = 0; i < (size_t) LogCategory::COUNT; i++) {
+        if (!strcmp(cstr, cstrFromLogCategory((LogCategory) i))) {
+            out = (LogCategory) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *cstrFromLogLevel(LogLevel level) {
+    switch (level) {
+        case LogLevel::Off:
+            return "off";
+        case LogLevel::Error:
+            return "error";
+        case LogLevel::Warn:
+            return "warn";
+        case LogLevel::Info:
+            return "info";
+        case LogLevel::Debug:
+            return "debug";
+        case LogLevel::Verbose:
+            return "verbose";
+    }
+    return "";
+}
+
+bool parseLogLevel(const char *cstr, LogLevel& out) {
+    for (uint8_t i = (uint8_t) LogLevel::Off; i <= (uint8_t) LogLevel::Verbose; i++) {
+        if (!strcmp(cstr, cstrFromLogLevel((LogLevel) i))) {
+            out = (LogLevel) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+AsyncLogger::AsyncLogger() {
+    levels[(size_t) LogCategory::Traffic] = (uint8_t) LogLevel::Info;
+    levels[(size_t) LogCategory::Ocpp] = (uint8_t) LogLevel::Verbose; //MO_DBG_LEVEL already limits the output at compile time
+}
+
+AsyncLogger::~AsyncLogger() {
+    stop();
+    delete[] ring;
+}
+
+bool AsyncLogger::start() {
+    if (running) {
+        return true;
+    }
+    if (!ring) {
+        ring = new Record [MO_SIM_LOG_SLOTS];
+    }
+    running = true;
+    writer = std::thread(&AsyncLogger::run, this);
+    return true;
+}
+
+void AsyncLogger::stop() {
+    if (!running) {
+        return;
+    }
+    running = false;
+    if (writer.joinable()) {
+        writer.join();
+    }
+    if (!line.empty()) {
+        fputs(line.c_str(), stdout); //incomplete last line
+        line.clear();
+    }
+    fflush(stdout);
+}
+
+void AsyncLogger::consoleOut(const char *msg) {
+    if (!running) {
+        fputs(msg, stdout);
+        return;
+    }
+
+    line.append(msg);
+
+    size_t begin = 0, end;
+    while ((end = line.find('\n', begin)) != std::string::npos) {
+        const char *text = line.c_str() + begin;
+        size_t len = end - begin;
+
+        //MicroOcpp prefixes its lines with "[MO] ", followed by the level or by Send: / Recv: for the traffic
+        if (len >= 5 && !strncmp(text, "[MO] ", 5)) {
+            text += 5;
+            len -= 5;
+        }
+
+        LogCategory category = LogCategory::Ocpp;
+        LogLevel level = LogLevel::Info;
+        if (!strncmp(text, "Send:", 5) || !strncmp(text, "Recv:", 5)) {
+            category = LogCategory::Traffic;
+        } else if (!strncmp(text, "ERROR", 5)) {
+            level = LogLevel::Error;
+        } else if (!strncmp(text, "warning", 7)) {
+            level = LogLevel::Warn;
+        } else if (!strncmp(text, "debug", 5)) {
+            level = LogLevel::Debug;
+        } else if (!strncmp(text, "verbose", 7)) {
+            level = LogLevel::Verbose;
+        }
+
+        if ((uint8_t) level <= levels[(size_t) category]) {
+            push(category, level, text, len);
+        }
+
+        begin = end + 1;
+    }
+    line.erase(0, begin);
+}
+
+void AsyncLogger::push(LogCategory category, LogLevel level, const char *text, size_t len) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= MO_SIM_LOG_SLOTS) {
+        droppedCount++;
+        return;
+    }
+
+    auto& record = ring[h % MO_SIM_LOG_SLOTS];
+    record.time = mocpp_tick_ms();
+    record.category = category;
+    record.level = level;
+    if (len > sizeof(record.text)) {
+        len = sizeof(record.text);
+    }
+    record.len = (uint16_t) len;
+    memcpy(record.text, text, len);
+    memcpy(record.chargerId, chargerId, sizeof(record.chargerId));
+
+    head.store(h + 1, std::memory_order_release);
+}
+
+void AsyncLogger::writeRecord(const Record& record) {
+    //escape the message as JSON string. Each input char expands to at most 6 chars
+    char msg [MO_SIM_LOG_TEXT_MAX * 6 + 1];
+    size_t n = 0;
+    for (size_t i = 0; i < record.len; i++) {
+        unsigned char c = (unsigned char) record.text[i];
+        if (c == '"' || c == '\\') {
+            msg[n++] = '\\';
+            msg[n++] = (char) c;
+        } else if (c < 0x20) {
+            n += snprintf(msg + n, sizeof(msg) - n, "\\u%04x", c);
+        } else {
+            msg[n++] = (char) c;
+        }
+    }
+    msg[n] = '\0';
+
+    printf("{\"t\":%lu,\"charger\":\"%s\",\"cat\":\"%s\",\"lvl\":\"%s\",\"msg\":\"%s\"}\n",
+            record.time, record.chargerId,
+            cstrFromLogCategory(record.category), cstrFromLogLevel(record.level), msg);
+}
+
+void AsyncLogger::run() {
+    while (true) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            if (!running) {
+                break; //flushed
+            }
+            fflush(stdout);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        writeRecord(ring[t % MO_SIM_LOG_SLOTS]);
+        writtenCount++;
+        tail.store(t + 1, std::memory_order_release);
+    }
+}
+
+void AsyncLogger::setChargerId(const char *chargerId) {
+    //the ids of the records are copied in the producer thread, so no lock is needed here
+    snprintf(this->chargerId, sizeof(this->chargerId), "%s", chargerId ? chargerId : "");
+}
+
+void AsyncLogger::setLevel(LogCategory category, LogLevel level) {
+    if (category < LogCategory::COUNT) {
+        levels[(size_t) category] = (uint8_t) level;
+    }
+}
+
+LogLevel AsyncLogger::getLevel(LogCategory category) {
+    if (category < LogCategory::COUNT) {
+        return (LogLevel) levels[(size_t) category].load();
+    }
+    return LogLevel::Off;
+}
+
+int AsyncLogger::writeStatusJson(char *buf, size_t size) {
+    int written = snprintf(buf, size, "{\"enabled\":%s,\"chargerId\":\"%s\",\"levels\":{",
+            running ? "true" : "false", chargerId);
+    for (size_t i = 0; i < (size_t) LogCategory::COUNT; i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        written += snprintf(buf + written, size - written, "%s\"%s\":\"%s\"",
+                i ? "," : "", cstrFromLogCategory((LogCategory) i), cstrFromLogLevel(getLevel((LogCategory) i)));
+    }
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "},\"buffered\":%zu,\"written\":%lu,\"dropped\":%lu}",
+            getBuffered(), getWritten(), getDropped());
+    return written;
+}
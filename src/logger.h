@@ -0,0 +1,106 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_LOGGER_H
+#define MO_SIM_LOGGER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#ifndef MO_SIM_ASYNC_LOG
+#define MO_SIM_ASYNC_LOG 0 //1: route the MicroOcpp console through AsyncLogger. Requires MO_CUSTOM_CONSOLE
+#endif
+
+#ifndef MO_SIM_LOG_SLOTS
+#define MO_SIM_LOG_SLOTS 1024 //capacity of the ring buffer in records
+#endif
+
+#ifndef MO_SIM_LOG_TEXT_MAX
+#define MO_SIM_LOG_TEXT_MAX 480 //longer lines are truncated
+#endif
+
+enum class LogCategory : uint8_t {
+    Traffic, //OCPP messages (MO_TRAFFIC_OUT)
+    Ocpp,    //MicroOcpp debug output
+    COUNT
+};
+
+enum class LogLevel : uint8_t {
+    Off,
+    Error,
+    Warn,
+    Info,
+    Debug,
+    Verbose
+};
+
+const char *cstrFromLogCategory(LogCategory category);
+bool parseLogCategory(const char *cstr, LogCategory& out);
+const char *cstrFromLogLevel(LogLevel level);
+bool parseLogLevel(const char *cstr, LogLevel& out);
+
+/*
+ * Logging sink which decouples the console output from the main loop. The main loop assembles
+ * the console fragments into lines, filters them by category and level and copies them into a
+ * single-producer single-consumer ring buffer. A background thread writes them to stdout as JSON
+ * lines tagged with the charger id. If the buffer is full, records are dropped and counted
+ * instead of blocking the main loop
+ */
+class AsyncLogger {
+private:
+    struct Record {
+        unsigned long time;
+        LogCategory category;
+        LogLevel level;
+        uint16_t len;
+        char chargerId [32];
+        char text [MO_SIM_LOG_TEXT_MAX];
+    };
+
+    Record *ring = nullptr;
+    std::atomic<size_t> head {0}; //next record to write, only modified by the producer
+    std::atomic<size_t> tail {0}; //next record to read, only modified by the consumer
+    std::atomic<unsigned long> droppedCount {0};
+    std::atomic<unsigned long> writtenCount {0};
+    std::atomic<bool> running {false};
+    std::thread writer;
+
+    std::atomic<uint8_t> levels [(size_t) LogCategory::COUNT];
+    std::string line; //fragments of the current line
+    char chargerId [32] = {'\0'};
+
+    void push(LogCategory category, LogLevel level, const char *text, size_t len);
+    void writeRecord(const Record& record);
+    void run();
+public:
+    AsyncLogger();
+    ~AsyncLogger();
+
+    //starts the background writer
+    bool start();
+
+    //writes all buffered records and stops the background writer
+    void stop();
+
+    //receives the console output of MicroOcpp, possibly split into several fragments per line
+    void consoleOut(const char *msg);
+
+    void setChargerId(const char *chargerId);
+
+    void setLevel(LogCategory category, LogLevel level);
+    LogLevel getLevel(LogCategory category);
+
+    unsigned long getDropped() {return droppedCount;}
+    unsigned long getWritten() {return writtenCount;}
+    size_t getBuffered() {return head - tail;}
+
+    int writeStatusJson(char *buf, size_t size);
+};
+
+extern AsyncLogger asyncLogger;
+
+#endif
@@ -3,6 +3,9 @@
 // GPL-3.0 License
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
 #include <signal.h>
 
 #include <mbedtls/platform.h>
@@ -12,16 +15,55 @@
 #include <MicroOcpp/Core/FilesystemUtils.h>
 #include "evse.h"
 #include "api.h"
+#include "traffic.h"
+#include "offline.h"
+#include "fs_memory.h"
+#include "journal.h"
+#include "startup.h"
+#include "site.h"
+#include "faults.h"
+#include "impair.h"
+#include "profile.h"
+#include "logger.h"
+#include "history.h"
+#include "tokens.h"
+#include "localauth.h"
+#include "throughput.h"
+#include "shutdown.h"
+#include "reboot.h"
 
 #include <MicroOcpp/Core/Memory.h>
 
-#if MO_NUMCONNECTORS == 3
-std::array<Evse, MO_NUMCONNECTORS - 1> connectors {{1,2}};
-#else
-std::array<Evse, MO_NUMCONNECTORS - 1> connectors {{1}};
-#endif
+//constructs the EVSEs with the connectorIds 1 to MO_NUMCONNECTORS - 1
+template <size_t... Ids> struct EvseIds {};
+template <size_t N, size_t... Ids> struct MakeEvseIds : MakeEvseIds<N - 1, N, Ids...> {};
+template <size_t... Ids> struct MakeEvseIds<0, Ids...> {using type = EvseIds<Ids...>;};
+
+template <size_t... Ids>
+std::array<Evse, sizeof...(Ids)> makeConnectors(EvseIds<Ids...>) {
+    return {{Evse(Ids)...}};
+}
+
+std::array<Evse, MO_NUMCONNECTORS - 1> connectors = makeConnectors(MakeEvseIds<MO_NUMCONNECTORS - 1>::type());
+
+OfflineStress offlineStress;
+StateJournal stateJournal;
+SimStartupStats startupStats;
+SiteModel site;
+FaultInjector faultInjector;
+NetImpairment netImpairment;
+ImpairedConnection *impairedConnection = nullptr;
+LoopProfiler profiler;
+AsyncLogger asyncLogger;
+MeterHistory meterHistory;
+TokenPopulation tokenPopulation;
+LocalAuthBench localAuthBench;
+TxThroughput txThroughput;
+ShutdownDrain shutdownDrain;
+SimReboot simReboot;
 
 bool g_isOcpp201 = false;
+const char *g_ocppVersionOverride = nullptr; //takes precedence over the stored version, e.g. from the command line
 bool g_runSimulator = true;
 
 bool g_isUpAndRunning = false; //if the initial BootNotification and StatusNotifications got through + 1s delay
@@ -38,7 +80,8 @@ unsigned int g_bootNotificationTime = 0;
 #include "net_mongoose.h"
 
 struct mg_mgr mgr;
-MicroOcpp::MOcppMongooseClient *osock;
+SimMongooseClient *osock;
+TrafficMeter *traffic;
 
 #elif MO_NETLIB == MO_NETLIB_WASM
 #include <emscripten.h>
@@ -48,6 +91,7 @@ MicroOcpp::MOcppMongooseClient *osock;
 #include "net_wasm.h"
 
 MicroOcpp::Connection *conn = nullptr;
+TrafficMeter *traffic = nullptr;
 
 #else
 #error Please ensure that build flag MO_NETLIB is set as MO_NETLIB_MONGOOSE or MO_NETLIB_WASM
@@ -71,33 +115,56 @@ void mo_mem_mbedtls_free( void *ptr ) {
 
 void mo_sim_sig_handler(int s){
 
-    if (!g_runSimulator) { //already tried to shut down, now force stop
-        exit(EXIT_FAILURE);
+    if (g_runSimulator) {
+        g_runSimulator = false; //shut down simulator gracefully
+    } else if (!shutdownDrain.isAborted()) {
+        shutdownDrain.abort(); //second signal, skip the drain but still save the state
+    } else {
+        exit(EXIT_FAILURE); //already tried to shut down, now force stop
     }
-
-    g_runSimulator = false; //shut down simulator gracefully
 }
 
 /*
  * Setup MicroOcpp and API
  */
-void load_ocpp_version(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem) {
+void load_simulator_state(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem) {
 
     MicroOcpp::configuration_init(filesystem);
 
     #if MO_ENABLE_V201
-    {
-        auto protocolVersion_stored = MicroOcpp::declareConfiguration<const char*>("OcppVersion", "1.6", SIMULATOR_FN, false, false, false);
-        MicroOcpp::configuration_load(SIMULATOR_FN);
-        if (!strcmp(protocolVersion_stored->getString(), "2.0.1")) {
-            //select OCPP 2.0.1
-            g_isOcpp201 = true;
-            return;
-        }
-    }
+    auto protocolVersion_stored = MicroOcpp::declareConfiguration<const char*>("OcppVersion", "1.6", SIMULATOR_FN, false, false, false);
     #endif //MO_ENABLE_V201
 
+    //declare the EVSE state before loading, so that SIMULATOR_FN is read only once
+    for (unsigned int i = 0; i < connectors.size(); i++) {
+        connectors[i].declareConfigurations();
+    }
+    site.declareConfigurations();
+    netImpairment.declareConfigurations();
+    meterHistory.declareConfigurations();
+    shutdownDrain.declareConfigurations();
+    simReboot.declareConfigurations();
+
+    MicroOcpp::configuration_load(SIMULATOR_FN);
+
+    stateJournal.setup(filesystem, MO_FILENAME_PREFIX "sim-state");
+    stateJournal.load();
+    meterHistory.setup(filesystem);
+    localAuthBench.setup(filesystem);
+
     g_isOcpp201 = false;
+
+    #if MO_ENABLE_V201
+    if (!strcmp(protocolVersion_stored->getString(), "2.0.1")) {
+        //select OCPP 2.0.1
+        g_isOcpp201 = true;
+    }
+    if (g_ocppVersionOverride) {
+        g_isOcpp201 = !strcmp(g_ocppVersionOverride, "2.0.1");
+    }
+    #endif //MO_ENABLE_V201
+
+    startupStats.storageLoaded = mocpp_tick_ms() - startupStats.start;
 }
 
 void app_setup(MicroOcpp::Connection& connection, std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem) {
@@ -115,16 +182,67 @@ void app_setup(MicroOcpp::Connection& connection, std::shared_ptr<MicroOcpp::Fil
     for (unsigned int i = 0; i < connectors.size(); i++) {
         connectors[i].setup();
     }
+
+    api_subscribe_events();
+
+    setOnResetExecute([] (bool isHard) {
+        simReboot.request(isHard); //this runs inside mocpp_loop(), so reboot after the loop iteration
+    });
+
+    //recompute the composite schedules after the server changed ChargingProfiles
+    for (auto operation : {"SetChargingProfile", "ClearChargingProfile"}) {
+        setOnReceiveRequest(operation, [] (JsonObject) {
+            for (unsigned int i = 0; i < connectors.size(); i++) {
+                connectors[i].getSchedule().invalidate();
+            }
+        });
+    }
+
+    startupStats.initialized = mocpp_tick_ms() - startupStats.start;
 }
 
 /*
  * Execute one loop iteration
  */
 void app_loop() {
-    mocpp_loop();
+    {
+        ProfileScope scope (LoopPhase::MicroOcpp);
+        mocpp_loop();
+    }
     for (unsigned int i = 0; i < connectors.size(); i++) {
+        ProfileScope scope (LoopPhase::Evse, connectors[i].getConnectorId());
         connectors[i].loop();
     }
+    offlineStress.loop();
+    faultInjector.loop();
+    meterHistory.loop();
+    if (!shutdownDrain.isDraining()) {
+        //don't generate new work while draining
+        tokenPopulation.loop();
+        txThroughput.loop();
+    }
+
+    if (!g_bootNotificationTime && getOcppContext()->getModel().getClock().now() >= MicroOcpp::MIN_TIME) {
+        //time has been set, BootNotification succeeded
+        g_bootNotificationTime = mocpp_tick_ms();
+        startupStats.bootNotification = g_bootNotificationTime - startupStats.start;
+        printf("[Sim] Startup: state loaded after %lu ms, initialized after %lu ms, BootNotification accepted after %lu ms\n",
+                startupStats.storageLoaded, startupStats.initialized, startupStats.bootNotification);
+    }
+
+    profiler.loop();
+}
+
+/*
+ * Save the simulator state and deinitialize MicroOcpp
+ */
+void app_deinit() {
+    for (unsigned int i = 0; i < connectors.size(); i++) {
+        connectors[i].saveState();
+    }
+    meterHistory.flush();
+
+    mocpp_deinitialize();
 }
 
 #if MO_NETLIB == MO_NETLIB_MONGOOSE
@@ -133,7 +251,42 @@ void app_loop() {
 #define MO_SIM_ENDPOINT_URL "http://0.0.0.0:8000" //URL to forward to mg_http_listen(). Will be ignored if the URL field exists in api.jsn
 #endif
 
-int main() {
+void print_usage(const char *prog) {
+    printf("Usage: %s [--ocpp 1.6|2.0.1] [--id <chargeBoxId>] [--backend <url>] [--api <url>]\n"
+           "Options override the stored settings of the Simulator in the current working directory\n", prog);
+}
+
+int main(int argc, char **argv) {
+
+    startupStats.start = mocpp_tick_ms();
+    profiler.reset();
+
+    //command line options, so that a fleet of Simulator processes can run with individual settings
+    const char *opt_ocpp = nullptr;
+    const char *opt_id = nullptr;
+    const char *opt_backend = nullptr;
+    const char *opt_api = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char **opt = nullptr;
+        if (!strcmp(argv[i], "--ocpp")) {
+            opt = &opt_ocpp;
+        } else if (!strcmp(argv[i], "--id")) {
+            opt = &opt_id;
+        } else if (!strcmp(argv[i], "--backend")) {
+            opt = &opt_backend;
+        } else if (!strcmp(argv[i], "--api")) {
+            opt = &opt_api;
+        }
+        if (!opt || i + 1 >= argc) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        *opt = argv[++i];
+    }
+    if (opt_ocpp && strcmp(opt_ocpp, "1.6") && strcmp(opt_ocpp, "2.0.1")) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
 
 #if MBEDTLS_PLATFORM_MEMORY
     mbedtls_platform_set_calloc_free(mo_mem_mbedtls_calloc, mo_mem_mbedtls_free);
@@ -144,16 +297,34 @@ int main() {
     sigemptyset(&sigIntHandler.sa_mask);
     sigIntHandler.sa_flags = 0;
     sigaction(SIGINT, &sigIntHandler, NULL);
+    sigaction(SIGTERM, &sigIntHandler, NULL);
+
+#if MO_SIM_ASYNC_LOG
+    mocpp_set_console_out([] (const char *msg) {
+        asyncLogger.consoleOut(msg);
+    });
+    asyncLogger.start();
+#endif
 
     mg_log_set(MG_LL_INFO);                            
     mg_mgr_init(&mgr);
 
+#if MO_SIM_RAMFS
+    auto ramfs = makeMemoryFilesystemAdapter();
+    std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem = ramfs;
+#else
     auto filesystem = MicroOcpp::makeDefaultFilesystemAdapter(MicroOcpp::FilesystemOpt::Use_Mount_FormatOnFail);
+#endif
 
-    load_ocpp_version(filesystem);
+    #if !MO_ENABLE_V201
+    if (opt_ocpp && !strcmp(opt_ocpp, "2.0.1")) {
+        MO_DBG_ERR("OCPP 2.0.1 not enabled in this build");
+        return EXIT_FAILURE;
+    }
+    #endif //!MO_ENABLE_V201
+    g_ocppVersionOverride = opt_ocpp;
 
-    struct mg_str api_cert = mg_file_read(&mg_fs_posix, MO_FILENAME_PREFIX "api_cert.pem");
-    struct mg_str api_key = mg_file_read(&mg_fs_posix, MO_FILENAME_PREFIX "api_key.pem");
+    load_simulator_state(filesystem);
 
     auto api_settings_doc = MicroOcpp::FilesystemUtils::loadJson(filesystem, MO_FILENAME_PREFIX "api.jsn", "Simulator");
     if (!api_settings_doc) {
@@ -161,37 +332,101 @@ int main() {
     }
     JsonObject api_settings = api_settings_doc->as<JsonObject>();
 
-    const char *api_url = api_settings["url"] | MO_SIM_ENDPOINT_URL;
+    const char *api_url = opt_api ? opt_api : (api_settings["url"] | MO_SIM_ENDPOINT_URL);
+
+    //the API certificate is only needed for a TLS listener
+    struct mg_str api_cert = mg_str_n(NULL, 0);
+    struct mg_str api_key = mg_str_n(NULL, 0);
+    if (mg_url_is_ssl(api_url)) {
+        api_cert = mg_file_read(&mg_fs_posix, MO_FILENAME_PREFIX "api_cert.pem");
+        api_key = mg_file_read(&mg_fs_posix, MO_FILENAME_PREFIX "api_key.pem");
+    }
 
     mg_http_listen(&mgr, api_url, http_serve, (void*)api_url);     // Create listening connection
 
-    osock = new MicroOcpp::MOcppMongooseClient(&mgr,
-        "ws://echo.websocket.events",
-        "charger-01",
-        "",
-        "",
-        filesystem,
-        g_isOcpp201 ?
-            MicroOcpp::ProtocolVersion{2,0,1} :
-            MicroOcpp::ProtocolVersion{1,6}
-        );
+    //the connection is created again after each simulated reboot
+    auto connection_setup = [&] () {
+        osock = new SimMongooseClient(&mgr,
+            "ws://echo.websocket.events",
+            "charger-01",
+            "",
+            "",
+            filesystem,
+            g_isOcpp201 ?
+                MicroOcpp::ProtocolVersion{2,0,1} :
+                MicroOcpp::ProtocolVersion{1,6}
+            );
 
-    server_initialize(osock, api_cert.buf ? api_cert.buf : "", api_key.buf ? api_key.buf : "", api_settings["user"] | "", api_settings["pass"] | "");
-    app_setup(*osock, filesystem);
+        if (opt_backend || opt_id) {
+            osock->updateCredentials(opt_backend, opt_id, nullptr);
+        }
 
-    setOnResetExecute([] (bool isHard) {
-        g_runSimulator = false;
-    });
+        asyncLogger.setChargerId(osock->getChargeBoxId());
+
+        impairedConnection = new ImpairedConnection(*osock, netImpairment, [] () {
+            return osock && osock->isConnected();
+        });
+        traffic = new TrafficMeter(*impairedConnection);
+        offlineStress.setup(&osock->getReconnectBackoff(), traffic, filesystem);
+        faultInjector.setup(&osock->getReconnectBackoff(), traffic);
+        txThroughput.setup(traffic);
+        shutdownDrain.setup(traffic, filesystem);
+
+        server_initialize(osock, api_cert.buf ? api_cert.buf : "", api_key.buf ? api_key.buf : "", api_settings["user"] | "", api_settings["pass"] | "");
+    };
+
+    auto connection_deinit = [&] () {
+        delete traffic;
+        traffic = nullptr;
+        delete impairedConnection;
+        impairedConnection = nullptr;
+        delete osock; //closes the WebSocket
+        osock = nullptr;
+        offlineStress.setup(nullptr, nullptr, filesystem);
+        faultInjector.setup(nullptr, nullptr);
+        shutdownDrain.setup(nullptr, filesystem);
+    };
+
+    connection_setup();
+    app_setup(*traffic, filesystem);
+
+    while (g_runSimulator) { //Run Simulator until user presses Ctrl+C or SIGTERM is received
+        {
+            ProfileScope scope (LoopPhase::NetPoll);
+            mg_mgr_poll(&mgr, 100);
+        }
+
+        if (simReboot.isRebooting()) {
+            //the charger is off until the reboot delay has elapsed. The API answers with 503 meanwhile
+            if (simReboot.isDelayElapsed()) {
+                load_simulator_state(filesystem);
+                connection_setup();
+                app_setup(*traffic, filesystem);
+                simReboot.end();
+            }
+            continue;
+        }
 
-    while (g_runSimulator) { //Run Simulator until OCPP Reset is executed or user presses Ctrl+C
-        mg_mgr_poll(&mgr, 100);
         app_loop();
 
-        if (!g_bootNotificationTime && getOcppContext()->getModel().getClock().now() >= MicroOcpp::MIN_TIME) {
-            //time has been set, BootNotification succeeded
-            g_bootNotificationTime = mocpp_tick_ms();
+        if (simReboot.isRequested()) {
+            //OCPP Reset executed. Deinitialize outside of mocpp_loop() and keep the process running
+            simReboot.begin();
+            txThroughput.stop();
+            tokenPopulation.rearm();
+            app_deinit();
+            connection_deinit();
+            g_bootNotificationTime = 0;
+            continue;
         }
 
+#if MO_SIM_RAMFS
+        {
+            ProfileScope scope (LoopPhase::Persistence);
+            ramfs->loop();
+        }
+#endif
+
         if (!g_isUpAndRunning && g_bootNotificationTime && mocpp_tick_ms() - g_bootNotificationTime >= 1000) {
             printf("[Sim] Resetting maximum heap usage after boot success\n");
             g_isUpAndRunning = true;
@@ -201,32 +436,123 @@ int main() {
 
     printf("[Sim] Shutting down Simulator\n");
 
+    //keep the loop running until the server confirmed the pending requests or the drain timeout expires
+    shutdownDrain.begin();
+    while (shutdownDrain.loop()) {
+        mg_mgr_poll(&mgr, 10);
+        app_loop();
+    }
+
     MO_MEM_PRINT_STATS();
 
-    mocpp_deinitialize();
+    if (!simReboot.isRebooting()) {
+        app_deinit();
+    }
+
+#if MO_SIM_RAMFS
+    ramfs->snapshot();
+#endif
+
+    shutdownDrain.report();
 
-    delete osock;
+    connection_deinit();
     mg_mgr_free(&mgr);
     free(api_cert.buf);
     free(api_key.buf);
+
+    asyncLogger.stop();
     return 0;
 }
 
 #elif MO_NETLIB == MO_NETLIB_WASM
 
+#include <emscripten/eventloop.h>
+
+#ifndef MO_SIM_WASM_LOOP_ACTIVE_MS
+#define MO_SIM_WASM_LOOP_ACTIVE_MS 20 //loop interval while messages are exchanged
+#endif
+
+#ifndef MO_SIM_WASM_LOOP_IDLE_MAX_MS
+#define MO_SIM_WASM_LOOP_IDLE_MAX_MS 1000 //the loop interval doubles while idle up to this value
+#endif
+
+/*
+ * Event-driven scheduling: the loop runs immediately after WebSocket events and API calls. After
+ * that, it runs at a short interval as long as messages are exchanged and backs off when idle.
+ * MicroOcpp doesn't expose its next deadline, so the idle interval is capped to stay within the
+ * one-second resolution of its timers (MeterValues, Heartbeat, request timeouts)
+ */
+long wasm_loop_timeout = 0;
+double wasm_loop_interval = MO_SIM_WASM_LOOP_ACTIVE_MS;
+bool wasm_loop_running = false;
+unsigned long wasm_loop_traffic = 0;
+
+void wasm_loop_schedule(double delay);
+
+void wasm_loop_run(void*) {
+    wasm_loop_timeout = 0;
+    wasm_loop_running = true;
+    app_loop();
+
+    if (simReboot.isRequested()) {
+        //OCPP Reset executed. The WebAssembly build has no in-place reboot, so save the state and leave
+        app_deinit();
+        exit(0);
+    }
+
+    wasm_state_update();
+    wasm_loop_running = false;
+
+    unsigned long trafficNow = traffic->getSentBytes() + traffic->getRecvBytes();
+    if (trafficNow != wasm_loop_traffic || traffic->getPendingCalls() > 0 || impairedConnection->getQueued() > 0) {
+        wasm_loop_traffic = trafficNow;
+        wasm_loop_interval = MO_SIM_WASM_LOOP_ACTIVE_MS;
+    } else {
+        wasm_loop_interval = std::min(2. * wasm_loop_interval, (double) MO_SIM_WASM_LOOP_IDLE_MAX_MS);
+    }
+
+    if (!wasm_loop_timeout) {
+        wasm_loop_schedule(wasm_loop_interval);
+    }
+}
+
+void wasm_loop_schedule(double delay) {
+    if (wasm_loop_timeout) {
+        emscripten_clear_timeout(wasm_loop_timeout);
+    }
+    wasm_loop_timeout = emscripten_set_timeout(wasm_loop_run, delay, nullptr);
+}
+
+void wasm_loop_wake() {
+    wasm_loop_interval = MO_SIM_WASM_LOOP_ACTIVE_MS;
+    if (!wasm_loop_running) {
+        wasm_loop_schedule(0);
+    }
+}
+
 int main() {
 
     printf("[WASM] start\n");
 
+    startupStats.start = mocpp_tick_ms();
+    profiler.reset();
+
     auto filesystem = MicroOcpp::makeDefaultFilesystemAdapter(MicroOcpp::FilesystemOpt::Deactivate);
 
+    load_simulator_state(filesystem);
+
     conn = wasm_ocpp_connection_init(nullptr, nullptr, nullptr);
 
-    app_setup(*conn, filesystem);
+    impairedConnection = new ImpairedConnection(*conn, netImpairment, wasm_ocpp_connection_is_open);
+    traffic = new TrafficMeter(*impairedConnection);
+    offlineStress.setup(wasm_ocpp_connection_get_backoff(), traffic, filesystem);
+    faultInjector.setup(wasm_ocpp_connection_get_backoff(), traffic);
+    txThroughput.setup(traffic);
+
+    app_setup(*traffic, filesystem);
 
-    const int LOOP_FREQ = 10; //called 10 times per second
-    const int BLOCK_INFINITELY = 0; //0 for non-blocking execution, 1 for blocking infinitely
-    emscripten_set_main_loop(app_loop, LOOP_FREQ, BLOCK_INFINITELY);
+    wasm_ocpp_connection_set_on_event(wasm_loop_wake);
+    wasm_loop_schedule(0);
 
     printf("[WASM] setup complete\n");
 }
@@ -5,6 +5,9 @@
 #include "net_mongoose.h"
 #include "evse.h"
 #include "api.h"
+#include "logger.h"
+#include "shutdown.h"
+#include "reboot.h"
 #include <MicroOcppMongooseClient.h>
 #include <string>
 #include <ArduinoJson.h>
@@ -15,13 +18,82 @@
 #define DEFAULT_HEADER "Content-Type: application/json\r\n"
 #define CORS_HEADERS "Access-Control-Allow-Origin: *\r\nAccess-Control-Allow-Headers:Access-Control-Allow-Headers, Origin,Accept, X-Requested-With, Content-Type, Access-Control-Request-Method, Access-Control-Request-Headers\r\nAccess-Control-Allow-Methods: GET,HEAD,OPTIONS,POST,PUT\r\n"
 
-MicroOcpp::MOcppMongooseClient *ao_sock = nullptr;
+SimMongooseClient *ao_sock = nullptr;
 const char *api_cert = "";
 const char *api_key = "";
 const char *api_user = "";
 const char *api_pass = "";
 
-void server_initialize(MicroOcpp::MOcppMongooseClient *osock, const char *cert, const char *key, const char *user, const char *pass) {
+SimMongooseClient::SimMongooseClient(struct mg_mgr *mgr,
+            const char *backend_url_factory,
+            const char *charge_box_id_factory,
+            const char *auth_key_factory,
+            const char *CA_cert_factory,
+            std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem,
+            MicroOcpp::ProtocolVersion protocolVersion) :
+        MOcppMongooseClient(mgr, backend_url_factory, charge_box_id_factory, auth_key_factory, CA_cert_factory, filesystem, protocolVersion) {
+
+    auto reconnectIntervalInt = MicroOcpp::declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "ReconnectInterval", 30, MO_WSCONN_FN);
+    backoff.setup(reconnectIntervalInt, MO_WSCONN_FN);
+
+    if (backoff.getRampUp() > 0) {
+        reloadConfigs(); //drop any connection which the base class may have opened already; the ramp-up decides about the first attempt
+    }
+}
+
+bool SimMongooseClient::stageCredentials(const char *backendUrl, const char *chargeBoxId, const char *authKey) {
+    //only the changed values are set, the setters persist them. The reconnect is left to applyCredentials()
+    bool changed = false;
+    if (backendUrl && strcmp(backendUrl, getBackendUrl())) {
+        setBackendUrl(backendUrl);
+        changed = true;
+    }
+    if (chargeBoxId && strcmp(chargeBoxId, getChargeBoxId())) {
+        setChargeBoxId(chargeBoxId);
+        changed = true;
+    }
+    if (authKey && strcmp(authKey, getAuthKey())) {
+        setAuthKey(authKey);
+        changed = true;
+    }
+    return changed;
+}
+
+void SimMongooseClient::applyCredentials() {
+    MO_DBG_INFO("connection settings changed, reconnect");
+    reloadConfigs();
+    asyncLogger.setChargerId(getChargeBoxId());
+}
+
+bool SimMongooseClient::updateCredentials(const char *backendUrl, const char *chargeBoxId, const char *authKey) {
+    if (!stageCredentials(backendUrl, chargeBoxId, authKey)) {
+        return false;
+    }
+    applyCredentials();
+    return true;
+}
+
+void SimMongooseClient::loop() {
+    bool open = isConnectionOpen();
+    if (open && !wasOpen) {
+        backoff.onConnected();
+    }
+    wasOpen = open;
+
+    if (backoff.isOffline()) {
+        if (open) {
+            MO_DBG_INFO("take connection offline");
+            reloadConfigs(); //closes WS connection; it won't be reopened until the backoff is back online
+        }
+        return;
+    }
+
+    if (open || !*getUrl() || backoff.allowAttempt()) {
+        MOcppMongooseClient::loop();
+    }
+}
+
+void server_initialize(SimMongooseClient *osock, const char *cert, const char *key, const char *user, const char *pass) {
     ao_sock = osock;
     api_cert = cert;
     api_key = key;
@@ -53,6 +125,15 @@ void http_serve(struct mg_connection *c, int ev, void *ev_data) {
         struct mg_http_message *message_data = reinterpret_cast<struct mg_http_message *>(ev_data);
         const char *final_headers = DEFAULT_HEADER CORS_HEADERS;
 
+        if (shutdownDrain.isDraining()) {
+            mg_http_reply(c, 503, final_headers, "Simulator is shutting down\n");
+            return;
+        }
+        if (simReboot.isRebooting()) {
+            mg_http_reply(c, 503, final_headers, "Simulator is rebooting\n");
+            return;
+        }
+
         char user[64], pass[64];
         mg_http_creds(message_data, user, sizeof(user), pass, sizeof(pass));
         if (!api_check_basic_auth(user, pass)) {
@@ -81,40 +162,83 @@ void http_serve(struct mg_connection *c, int ev, void *ev_data) {
             auto reconnectIntervalInt = MicroOcpp::declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "ReconnectInterval", 30, MO_WSCONN_FN);
                     
             if (method == MicroOcpp::Method::POST) {
-                if (auto val = mg_json_get_str(json, "$.backendUrl")) {
-                    ao_sock->setBackendUrl(val);
-                }
-                if (auto val = mg_json_get_str(json, "$.chargeBoxId")) {
-                    ao_sock->setChargeBoxId(val);
+                char *backendUrl = mg_json_get_str(json, "$.backendUrl");
+                char *chargeBoxId = mg_json_get_str(json, "$.chargeBoxId");
+                char *authKey = mg_json_get_str(json, "$.authorizationKey");
+                char *reconnectStrategy = mg_json_get_str(json, "$.reconnectStrategy");
+                long pingInterval = mg_json_get_long(json, "$.pingInterval", -1);
+                long reconnectInterval = mg_json_get_long(json, "$.reconnectInterval", -1);
+                long reconnectMaxInterval = mg_json_get_long(json, "$.reconnectMaxInterval", -1);
+                long reconnectRampUp = mg_json_get_long(json, "$.reconnectRampUp", -1);
+                if (auto val = mg_json_get_str(json, "$.dnsUrl")) {
+                    MO_DBG_WARN("dnsUrl not implemented");
+                    free(val);
                 }
-                if (auto val = mg_json_get_str(json, "$.authorizationKey")) {
-                    ao_sock->setAuthKey(val);
+
+                //validate the whole update before applying any of it
+                const char *invalid = nullptr;
+                ReconnectStrategy strategyParsed = ReconnectStrategy::Fixed;
+                if (reconnectStrategy && !parseReconnectStrategy(reconnectStrategy, strategyParsed)) {
+                    invalid = "invalid reconnectStrategy";
+                } else if (authKey && strlen(authKey) > MO_AUTHKEY_LEN_MAX) {
+                    invalid = "invalid authorizationKey";
                 }
-                ao_sock->reloadConfigs();
-                {
-                    auto val = mg_json_get_long(json, "$.pingInterval", -1);
-                    if (val > 0) {
-                        webSocketPingIntervalInt->setInt(val);
+
+                if (!invalid) {
+                    //reconnect only once, and only if the endpoint or credentials change
+                    bool credentialsChanged = ao_sock->stageCredentials(backendUrl, chargeBoxId, authKey);
+
+                    auto& backoff = ao_sock->getReconnectBackoff();
+                    bool changed = false;
+                    if (pingInterval > 0 && pingInterval != webSocketPingIntervalInt->getInt()) {
+                        webSocketPingIntervalInt->setInt(pingInterval);
+                        changed = true;
                     }
-                }
-                {
-                    auto val = mg_json_get_long(json, "$.reconnectInterval", -1);
-                    if (val > 0) {
-                        reconnectIntervalInt->setInt(val);
+                    if (reconnectInterval > 0 && reconnectInterval != reconnectIntervalInt->getInt()) {
+                        reconnectIntervalInt->setInt(reconnectInterval);
+                        changed = true;
+                    }
+                    if (reconnectStrategy && strategyParsed != backoff.getStrategy()) {
+                        backoff.setStrategy(reconnectStrategy);
+                        changed = true;
+                    }
+                    if (reconnectMaxInterval >= 0 && reconnectMaxInterval != backoff.getMaxInterval()) {
+                        backoff.setMaxInterval(reconnectMaxInterval);
+                        changed = true;
+                    }
+                    if (reconnectRampUp >= 0 && reconnectRampUp != backoff.getRampUp()) {
+                        backoff.setRampUp(reconnectRampUp);
+                        changed = true;
+                    }
+                    if (changed) {
+                        MicroOcpp::configuration_save();
+                    }
+                    if (credentialsChanged) {
+                        ao_sock->applyCredentials();
                     }
                 }
-                if (auto val = mg_json_get_str(json, "$.dnsUrl")) {
-                    MO_DBG_WARN("dnsUrl not implemented");
-                    (void)val;
+
+                free(backendUrl);
+                free(chargeBoxId);
+                free(authKey);
+                free(reconnectStrategy);
+
+                if (invalid) {
+                    mg_http_reply(c, 400, final_headers, "%s", invalid);
+                    return;
                 }
-                MicroOcpp::configuration_save();
             }
-            StaticJsonDocument<256> doc;
+            StaticJsonDocument<512> doc;
             doc["backendUrl"] = ao_sock->getBackendUrl();
             doc["chargeBoxId"] = ao_sock->getChargeBoxId();
             doc["authorizationKey"] = ao_sock->getAuthKey();
             doc["pingInterval"] = webSocketPingIntervalInt->getInt();
             doc["reconnectInterval"] = reconnectIntervalInt->getInt();
+            doc["reconnectStrategy"] = cstrFromReconnectStrategy(ao_sock->getReconnectBackoff().getStrategy());
+            doc["reconnectMaxInterval"] = ao_sock->getReconnectBackoff().getMaxInterval();
+            doc["reconnectRampUp"] = ao_sock->getReconnectBackoff().getRampUp();
+            doc["connectAttempts"] = ao_sock->getReconnectBackoff().getAttempts();
+            doc["connectAttemptsPerSecond"] = ao_sock->getReconnectBackoff().getAttemptsPerSecond();
             std::string serialized;
             serializeJson(doc, serialized);
             mg_http_reply(c, 200, final_headers, serialized.c_str());
@@ -8,12 +8,45 @@
 #if MO_NETLIB == MO_NETLIB_MONGOOSE
 
 #include "mongoose.h"
-
-namespace MicroOcpp {
-class MOcppMongooseClient;
-}
-
-void server_initialize(MicroOcpp::MOcppMongooseClient *osock, const char *cert = "", const char *key = "", const char *user = "", const char *pass = "");
+#include <MicroOcppMongooseClient.h>
+
+#include "reconnect.h"
+
+/*
+ * MOcppMongooseClient which leaves the timing of connection attempts to the ReconnectBackoff
+ */
+class SimMongooseClient : public MicroOcpp::MOcppMongooseClient {
+private:
+    ReconnectBackoff backoff;
+    bool wasOpen = false;
+public:
+    SimMongooseClient(struct mg_mgr *mgr,
+            const char *backend_url_factory,
+            const char *charge_box_id_factory,
+            const char *auth_key_factory,
+            const char *CA_cert_factory,
+            std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem,
+            MicroOcpp::ProtocolVersion protocolVersion);
+
+    void loop() override;
+
+    //sets the given endpoint and credentials (nullptr to keep the current value) without
+    //reconnecting. Returns true if any of them has changed. The caller validates the values
+    bool stageCredentials(const char *backendUrl, const char *chargeBoxId, const char *authKey);
+
+    //reconnects with the staged credentials
+    void applyCredentials();
+
+    //stages the given values and reconnects once if any of them has changed.
+    //Returns true if the connection has been reloaded
+    bool updateCredentials(const char *backendUrl, const char *chargeBoxId, const char *authKey);
+
+    ReconnectBackoff& getReconnectBackoff() {
+        return backoff;
+    }
+};
+
+void server_initialize(SimMongooseClient *osock, const char *cert = "", const char *key = "", const char *user = "", const char *pass = "");
 
 void http_serve(struct mg_connection *c, int ev, void *ev_data);
 
@@ -6,19 +6,48 @@
 
 #include <string>
 #include <memory>
+#include <cstring>
 #include <emscripten/websocket.h>
+#include <emscripten/em_js.h>
 
 #include <MicroOcpp/Core/Connection.h>
 #include <MicroOcpp/Core/Configuration.h>
 #include <MicroOcpp/Debug.h>
 
 #include "api.h"
+#include "evse.h"
+#include "reconnect.h"
 
 #define DEBUG_MSG_INTERVAL 5000UL
 #define WS_UNRESPONSIVE_THRESHOLD_MS 15000UL
+#define WS_SEND_BUFFERED_MAX 65536UL //backpressure: refuse sending while the browser hasn't transmitted this many bytes yet
 
 using namespace MicroOcpp;
 
+//sends the text frame straight from the message buffer. emscripten_websocket_send_utf8_text expects a
+//NUL-terminated string, which would require a copy. UTF8ToString decodes at most len bytes instead.
+//WS and UTF8ToString are part of the runtime because of -lwebsocket.js
+EM_JS(int, wasm_websocket_send_text, (EMSCRIPTEN_WEBSOCKET_T socket, const char *msg, size_t len), {
+    var ws = WS.sockets[socket];
+    if (!ws) {
+        return -3; //EMSCRIPTEN_RESULT_INVALID_TARGET
+    }
+    try {
+        ws.send(UTF8ToString(msg, len));
+    } catch (e) {
+        return -1; //EMSCRIPTEN_RESULT_DEFERRED
+    }
+    return 0;
+});
+
+void (*wasm_on_event)() = nullptr;
+
+void wasm_notify_event() {
+    if (wasm_on_event) {
+        wasm_on_event();
+    }
+}
+
 class WasmOcppConnection : public Connection {
 private:
     EMSCRIPTEN_WEBSOCKET_T websocket;
@@ -32,7 +61,7 @@ private:
     std::shared_ptr<Configuration> setting_auth_key_str;
     unsigned long last_status_dbg_msg {0}, last_recv {0};
     std::shared_ptr<Configuration> reconnect_interval_int; //minimum time between two connect trials in s
-    unsigned long last_reconnection_attempt {-1UL / 2UL};
+    ReconnectBackoff reconnect_backoff;
     std::shared_ptr<Configuration> stale_timeout_int; //inactivity period after which the connection will be closed
     std::shared_ptr<Configuration> ws_ping_interval_int; //heartbeat intervall in s. 0 sets hb off
     unsigned long last_hb {0};
@@ -67,6 +96,12 @@ private:
             MO_DBG_VERBOSE("omit heartbeat");
         }
 
+        if (websocket && isConnectionOpen() && reconnect_backoff.isOffline()) {
+            MO_DBG_INFO("connection %s -- take offline", url.c_str());
+            reconnect(); //won't be reopened until the backoff is back online
+            return;
+        }
+
         if (websocket != NULL) { //connection pointer != NULL means that the socket is still open
             return;
         }
@@ -76,14 +111,12 @@ private:
             return;
         }
 
-        if (reconnect_interval_int && reconnect_interval_int->getInt() > 0 && mocpp_tick_ms() - last_reconnection_attempt < (reconnect_interval_int->getInt() * 1000UL)) {
+        if (!reconnect_backoff.allowAttempt()) {
             return;
         }
 
         MO_DBG_DEBUG("(re-)connect to %s", url.c_str());
 
-        last_reconnection_attempt = mocpp_tick_ms();
-
         EmscriptenWebSocketCreateAttributes attr;
         emscripten_websocket_init_create_attributes(&attr);
 
@@ -110,6 +143,7 @@ private:
                     MO_DBG_INFO("connection %s -- connected!", conn->getUrl());
                     conn->setConnectionOpen(true);
                     conn->updateRcvTimer();
+                    wasm_notify_event();
                     return true;
                 });
         if (ret_open < 0) {
@@ -121,12 +155,17 @@ private:
                 this,
                 [] (int eventType, const EmscriptenWebSocketMessageEvent *websocketEvent, void *userData) -> EM_BOOL {
                     WasmOcppConnection *conn = reinterpret_cast<WasmOcppConnection*>(userData);
-                    MO_DBG_DEBUG("evenType: %i", eventType);
-                    MO_DBG_DEBUG("txt: %s", websocketEvent->data ? (const char*) websocketEvent->data : "undefined");
-                    if (!conn->getReceiveTXTcallback()((const char*) websocketEvent->data, websocketEvent->numBytes)) {
+                    MO_DBG_VERBOSE("evenType: %i", eventType);
+                    if (!websocketEvent->data) {
+                        return true;
+                    }
+                    //for text frames, numBytes includes the NUL-terminator
+                    size_t len = websocketEvent->isText && websocketEvent->numBytes > 0 ? websocketEvent->numBytes - 1 : websocketEvent->numBytes;
+                    if (!conn->getReceiveTXTcallback()((const char*) websocketEvent->data, len)) {
                         MO_DBG_WARN("processing input message failed");
                     }
                     conn->updateRcvTimer();
+                    wasm_notify_event();
                     return true;
                 });
         if (ret_message < 0) {
@@ -141,6 +180,7 @@ private:
                     MO_DBG_DEBUG("on error eventType: %i", eventType);
                     MO_DBG_INFO("connection %s -- %s", conn->getUrl(), "error");
                     conn->cleanConnection();
+                    wasm_notify_event();
                     return true;
                 });
         if (ret_open < 0) {
@@ -155,6 +195,7 @@ private:
                     MO_DBG_DEBUG("on close eventType: %i", eventType);
                     MO_DBG_INFO("connection %s -- %s", conn->getUrl(), "closed");
                     conn->cleanConnection();
+                    wasm_notify_event();
                     return true;
                 });
         if (ret_open < 0) {
@@ -192,6 +233,8 @@ public:
         stale_timeout_int = declareConfiguration<int>(
             MO_CONFIG_EXT_PREFIX "StaleTimeout", 300, CONFIGURATION_VOLATILE);
 
+        reconnect_backoff.setup(reconnect_interval_int, CONFIGURATION_VOLATILE);
+
         reloadConfigs(); //load WS creds with configs values
 
         MO_DBG_DEBUG("connection initialized");
@@ -215,8 +258,16 @@ public:
             return false;
         }
 
-        if (auto ret = emscripten_websocket_send_utf8_text(websocket, msg) < 0) {
-            MO_DBG_ERR("emscripten_websocket_send_utf8_text: %i", ret);
+        size_t buffered = 0;
+        if (emscripten_websocket_get_buffered_amount(websocket, &buffered) >= 0 && buffered > WS_SEND_BUFFERED_MAX) {
+            MO_DBG_DEBUG("WS congested, retry later");
+            return false;
+        }
+
+        //msg is only valid up to length and not necessarily NUL-terminated
+        auto ret = wasm_websocket_send_text(websocket, msg, length);
+        if (ret < 0) {
+            MO_DBG_ERR("wasm_websocket_send_text: %i", ret);
             return false;
         }
 
@@ -239,7 +290,6 @@ public:
 
         if (setting_backend_url_str) {
             setting_backend_url_str->setString(backend_url_cstr);
-            configuration_save();
         }
     }
 
@@ -251,7 +301,6 @@ public:
 
         if (setting_cb_id_str) {
             setting_cb_id_str->setString(cb_id_cstr);
-            configuration_save();
         }
     }
 
@@ -263,10 +312,33 @@ public:
 
         if (setting_auth_key_str) {
             setting_auth_key_str->setString(auth_key_cstr);
-            configuration_save();
         }
     }
 
+    //applies the given endpoint and credentials (nullptr to keep the current value) and
+    //reconnects if any of them has changed. The caller saves the configuration
+    bool updateCredentials(const char *backend_url_cstr, const char *cb_id_cstr, const char *auth_key_cstr) {
+        bool changed = false;
+        if (backend_url_cstr && backend_url.compare(backend_url_cstr)) {
+            setBackendUrl(backend_url_cstr);
+            changed = true;
+        }
+        if (cb_id_cstr && cb_id.compare(cb_id_cstr)) {
+            setChargeBoxId(cb_id_cstr);
+            changed = true;
+        }
+        if (auth_key_cstr && auth_key.compare(auth_key_cstr)) {
+            setAuthKey(auth_key_cstr);
+            changed = true;
+        }
+
+        if (changed) {
+            MO_DBG_INFO("connection settings changed, reconnect");
+            reloadConfigs();
+        }
+        return changed;
+    }
+
     void reloadConfigs() {
 
         reconnect(); //closes WS connection; will be reopened in next maintainWsConn execution
@@ -320,10 +392,13 @@ public:
 
     const char *getUrl() {return url.c_str();}
 
+    ReconnectBackoff& getReconnectBackoff() {return reconnect_backoff;}
+
     void setConnectionOpen(bool open) {
         if (open) {
             connection_established = true;
             last_connection_established = mocpp_tick_ms();
+            reconnect_backoff.onConnected();
         } else {
             connection_closing = true;
         }
@@ -357,6 +432,121 @@ MicroOcpp::Connection *wasm_ocpp_connection_init(const char *backend_url_default
     return wasm_ocpp_connection_instance;
 }
 
+ReconnectBackoff *wasm_ocpp_connection_get_backoff() {
+    return wasm_ocpp_connection_instance ? &wasm_ocpp_connection_instance->getReconnectBackoff() : nullptr;
+}
+
+bool wasm_ocpp_connection_is_open() {
+    return wasm_ocpp_connection_instance && wasm_ocpp_connection_instance->isConnectionOpen();
+}
+
+void wasm_ocpp_connection_set_on_event(void (*on_event)()) {
+    wasm_on_event = on_event;
+}
+
+WasmSimState wasm_state;
+bool wasm_state_subscribed = false;
+bool wasm_state_dirty = true;
+
+void wasm_state_update() {
+    if (!wasm_state_subscribed) {
+        for (size_t i = 0; i < connectors.size(); i++) {
+            connectors[i].addListener([] (Evse&, EvseEvent) {
+                wasm_state_dirty = true;
+            });
+        }
+        wasm_state_subscribed = true;
+    }
+
+    bool charging = false;
+    for (size_t i = 0; i < connectors.size(); i++) {
+        charging |= connectors[i].isCharging();
+    }
+    bool connected = wasm_ocpp_connection_instance && wasm_ocpp_connection_instance->isConnectionOpen();
+
+    //idle connectors only change on events. While charging, the meter values change continuously
+    if (!wasm_state_dirty && !charging && wasm_state.connected == (connected ? 1 : 0)) {
+        return;
+    }
+    wasm_state_dirty = false;
+
+    WasmSimState next;
+    memset(&next, 0, sizeof(next));
+    next.layout = MO_WASM_STATE_LAYOUT;
+    next.revision = wasm_state.revision;
+    next.connected = connected ? 1 : 0;
+    next.numConnectors = connectors.size();
+    next.connectorStateSize = sizeof(WasmConnectorState);
+
+    for (size_t i = 0; i < connectors.size(); i++) {
+        auto& evse = connectors[i];
+        auto& state = next.connectors[i];
+        state.status = (int32_t) evse.getOcppStatusCode();
+        state.evPlugged = evse.getEvPlugged();
+        state.evsePlugged = evse.getEvsePlugged();
+        state.evReady = evse.getEvReady();
+        state.evseReady = evse.getEvseReady();
+        state.transactionId = evse.getTransactionId();
+        state.energy = evse.getEnergy();
+        state.power = evse.getPower();
+        state.current = evse.getCurrent();
+        state.voltage = evse.getVoltage();
+        state.smartChargingMaxPower = evse.getSmartChargingMaxPower();
+        state.smartChargingMaxCurrent = evse.getSmartChargingMaxCurrent();
+    }
+
+    if (memcmp(&next, &wasm_state, sizeof(next))) {
+        next.revision++;
+        wasm_state = next;
+    }
+}
+
+//exported to WebAssembly. The UI reads the state in place, e.g. with
+//new DataView(Module.HEAPU8.buffer, ptr, Module.HEAPU8.length - ptr)
+extern "C" WasmSimState *mocpp_wasm_state() {
+    return &wasm_state;
+}
+
+//exported to WebAssembly. Returns 0 on success, -1 if the command or connectorId is invalid
+extern "C" int mocpp_wasm_command(int command, unsigned int connectorId, int value) {
+    if (connectorId < 1 || connectorId > connectors.size()) {
+        MO_DBG_WARN("invalid connectorId: %u", connectorId);
+        return -1;
+    }
+    auto& evse = connectors[connectorId - 1];
+
+    switch (command) {
+        case MO_WASM_CMD_EV_PLUGGED:
+            evse.setEvPlugged(value != 0);
+            break;
+        case MO_WASM_CMD_EVSE_PLUGGED:
+            evse.setEvsePlugged(value != 0);
+            break;
+        case MO_WASM_CMD_EV_READY:
+            evse.setEvReady(value != 0);
+            break;
+        case MO_WASM_CMD_EVSE_READY:
+            evse.setEvseReady(value != 0);
+            break;
+        case MO_WASM_CMD_PLUGIN:
+            evse.setEvPlugged(true);
+            evse.setEvReady(true);
+            evse.setEvseReady(true);
+            break;
+        case MO_WASM_CMD_PLUGOUT:
+            evse.setEvPlugged(false);
+            evse.setEvReady(false);
+            evse.setEvseReady(false);
+            break;
+        default:
+            MO_DBG_WARN("invalid command: %i", command);
+            return -1;
+    }
+
+    wasm_notify_event();
+    return 0;
+}
+
 #define MO_WASM_RESP_BUF_SIZE 1024
 char wasm_resp_buf [MO_WASM_RESP_BUF_SIZE] = {'\0'};
 
@@ -364,6 +554,8 @@ char wasm_resp_buf [MO_WASM_RESP_BUF_SIZE] = {'\0'};
 extern "C" char* mocpp_wasm_api_call(const char *endpoint, const char *method, const char *body) {
     MO_DBG_DEBUG("API call: %s, %s, %s", endpoint, method, body);
 
+    wasm_notify_event(); //inputs may change, process them in the next loop run
+
     auto method_parsed = Method::UNDEFINED;
     if (!strcmp(method, "GET")) {
         method_parsed = Method::GET;
@@ -391,27 +583,52 @@ extern "C" char* mocpp_wasm_api_call(const char *endpoint, const char *method, c
         auto reconnectInterval = declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "ReconnectInterval", 10, CONFIGURATION_VOLATILE);
 
         if (method_parsed == Method::POST) {
-            if (request.containsKey("backendUrl")) {
-                wasm_ocpp_connection_instance->setBackendUrl(request["backendUrl"] | "");
+            auto& backoff = wasm_ocpp_connection_instance->getReconnectBackoff();
+
+            //validate the whole update before applying any of it
+            ReconnectStrategy strategyParsed = ReconnectStrategy::Fixed;
+            if (request.containsKey("reconnectStrategy") && !parseReconnectStrategy(request["reconnectStrategy"] | "", strategyParsed)) {
+                MO_DBG_WARN("invalid reconnectStrategy");
+                return nullptr;
             }
-            if (request.containsKey("chargeBoxId")) {
-                wasm_ocpp_connection_instance->setChargeBoxId(request["chargeBoxId"] | "");
+
+            //reconnects only if the endpoint or credentials change
+            bool changed = wasm_ocpp_connection_instance->updateCredentials(
+                    request.containsKey("backendUrl") ? (request["backendUrl"] | "") : nullptr,
+                    request.containsKey("chargeBoxId") ? (request["chargeBoxId"] | "") : nullptr,
+                    request.containsKey("authorizationKey") ? (request["authorizationKey"] | "") : nullptr);
+
+            int pingInterval = request["pingInterval"] | -1;
+            if (pingInterval > 0 && pingInterval != webSocketPingInterval->getInt()) {
+                webSocketPingInterval->setInt(pingInterval);
+                changed = true;
+            }
+            int reconnectIntervalVal = request["reconnectInterval"] | -1;
+            if (reconnectIntervalVal > 0 && reconnectIntervalVal != reconnectInterval->getInt()) {
+                reconnectInterval->setInt(reconnectIntervalVal);
+                changed = true;
             }
-            if (request.containsKey("authorizationKey")) {
-                wasm_ocpp_connection_instance->setAuthKey(request["authorizationKey"] | "");
+            if (request.containsKey("reconnectStrategy") && strategyParsed != backoff.getStrategy()) {
+                backoff.setStrategy(request["reconnectStrategy"] | "");
+                changed = true;
             }
-            wasm_ocpp_connection_instance->reloadConfigs();
-            if (request.containsKey("pingInterval")) {
-                webSocketPingInterval->setInt(request["pingInterval"] | 0);
+            int reconnectMaxInterval = request["reconnectMaxInterval"] | -1;
+            if (reconnectMaxInterval >= 0 && reconnectMaxInterval != backoff.getMaxInterval()) {
+                backoff.setMaxInterval(reconnectMaxInterval);
+                changed = true;
             }
-            if (request.containsKey("reconnectInterval")) {
-                reconnectInterval->setInt(request["reconnectInterval"] | 0);
+            int reconnectRampUp = request["reconnectRampUp"] | -1;
+            if (reconnectRampUp >= 0 && reconnectRampUp != backoff.getRampUp()) {
+                backoff.setRampUp(reconnectRampUp);
+                changed = true;
             }
             if (request.containsKey("dnsUrl")) {
                 MO_DBG_WARN("dnsUrl not implemented");
                 (void)0;
             }
-            MicroOcpp::configuration_save();
+            if (changed) {
+                MicroOcpp::configuration_save();
+            }
         }
 
         StaticJsonDocument<512> response;
@@ -421,6 +638,11 @@ extern "C" char* mocpp_wasm_api_call(const char *endpoint, const char *method, c
 
         response["pingInterval"] = webSocketPingInterval ? webSocketPingInterval->getInt() : 0;
         response["reconnectInterval"] = reconnectInterval ? reconnectInterval->getInt() : 0;
+        response["reconnectStrategy"] = cstrFromReconnectStrategy(wasm_ocpp_connection_instance->getReconnectBackoff().getStrategy());
+        response["reconnectMaxInterval"] = wasm_ocpp_connection_instance->getReconnectBackoff().getMaxInterval();
+        response["reconnectRampUp"] = wasm_ocpp_connection_instance->getReconnectBackoff().getRampUp();
+        response["connectAttempts"] = wasm_ocpp_connection_instance->getReconnectBackoff().getAttempts();
+        response["connectAttemptsPerSecond"] = wasm_ocpp_connection_instance->getReconnectBackoff().getAttemptsPerSecond();
         serializeJson(response, wasm_resp_buf, MO_WASM_RESP_BUF_SIZE);
         return wasm_resp_buf;
     }
@@ -7,10 +7,66 @@
 
 #if MO_NETLIB == MO_NETLIB_WASM
 
+#include <cstdint>
 #include <MicroOcpp/Core/Connection.h>
 
 MicroOcpp::Connection *wasm_ocpp_connection_init(const char *backend_url_default, const char *charge_box_id_default, const char *auth_key_default);
 
+class ReconnectBackoff;
+
+ReconnectBackoff *wasm_ocpp_connection_get_backoff();
+
+bool wasm_ocpp_connection_is_open();
+
+/*
+ * Compact commands for the UI. The values are part of the interface to mo_sim_worker.mjs
+ */
+enum WasmCommand {
+    MO_WASM_CMD_EV_PLUGGED = 1,     //value: 0 / 1
+    MO_WASM_CMD_EVSE_PLUGGED = 2,   //value: 0 / 1
+    MO_WASM_CMD_EV_READY = 3,       //value: 0 / 1
+    MO_WASM_CMD_EVSE_READY = 4,     //value: 0 / 1
+    MO_WASM_CMD_PLUGIN = 5,         //plug in EV and set EV and EVSE ready; value ignored
+    MO_WASM_CMD_PLUGOUT = 6,        //unplug EV; value ignored
+};
+
+/*
+ * State snapshot which the UI reads directly from the WebAssembly memory (see mocpp_wasm_state()).
+ * All fields are 32 bit wide. Extend only by appending fields and increment MO_WASM_STATE_LAYOUT
+ * on any other change
+ */
+#define MO_WASM_STATE_LAYOUT 1
+
+struct WasmConnectorState {
+    int32_t status; //ChargePointStatus enum value
+    int32_t evPlugged;
+    int32_t evsePlugged;
+    int32_t evReady;
+    int32_t evseReady;
+    int32_t transactionId; //-1 if no transaction is running
+    int32_t energy; //in Wh
+    int32_t power; //in W
+    float current; //in A
+    float voltage; //in V
+    int32_t smartChargingMaxPower; //in W
+    float smartChargingMaxCurrent; //in A
+};
+
+struct WasmSimState {
+    uint32_t layout; //MO_WASM_STATE_LAYOUT
+    uint32_t revision; //incremented when any other field changes
+    uint32_t connected; //1 if the WebSocket is open
+    uint32_t numConnectors;
+    uint32_t connectorStateSize; //sizeof(WasmConnectorState)
+    WasmConnectorState connectors [MO_NUMCONNECTORS - 1];
+};
+
+//refreshes the state snapshot. Called after each loop run
+void wasm_state_update();
+
+//called after each WebSocket event and API call, e.g. to wake up the main loop
+void wasm_ocpp_connection_set_on_event(void (*on_event)());
+
 #endif //MO_NETLIB == MO_NETLIB_WASM
 
 #endif
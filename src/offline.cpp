@@ -0,0 +1,181 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "offline.h"
+
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <ArduinoJson.h>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "reconnect.h"
+#include "traffic.h"
+
+#define OFFLINE_MEASUREMENT_INTERVAL 1000UL
+#define OFFLINE_DRAIN_QUIET_PERIOD 2000UL //the queue counts as drained if no new request was sent for this period
+
+//files in which MicroOcpp persists transactions and their meter data
+const char *offlineQueueFilePrefixes [] = {"tx", "sd", "op"};
+
+const char *cstrFromOfflineStressState(OfflineStress::State state) {
+    switch (state) {
+        case OfflineStress::State::Idle:
+            return "Idle";
+        case OfflineStress::State::Offline:
+            return "Offline";
+        case OfflineStress::State::Draining:
+            return "Draining";
+        case OfflineStress::State::Drained:
+            return "Drained";
+    }
+    return "Idle";
+}
+
+void OfflineStress::setup(ReconnectBackoff *backoff, TrafficMeter *traffic, std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem) {
+    this->backoff = backoff;
+    this->traffic = traffic;
+    this->filesystem = filesystem;
+
+    //after a simulated reboot, carry the run over to the new connection
+    if (backoff && state == State::Offline) {
+        backoff->setOffline(OfflineSource::OfflineStress, true);
+    }
+    if (traffic && state == State::Draining) {
+        //the new TrafficMeter counts from 0. Rebase, so that flushedCalls continues from its current value (modulo arithmetic)
+        sentCallsAtReconnect = traffic->getSentCalls() - flushedCalls;
+    }
+}
+
+void measureOfflineQueue(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem, size_t& filesOut, size_t& bytesOut) {
+    filesOut = 0;
+    bytesOut = 0;
+    if (!filesystem) {
+        return;
+    }
+    filesystem->ftw_root([&filesystem, &filesOut, &bytesOut] (const char *fname) -> int {
+        for (size_t i = 0; i < sizeof(offlineQueueFilePrefixes) / sizeof(offlineQueueFilePrefixes[0]); i++) {
+            if (!strncmp(fname, offlineQueueFilePrefixes[i], strlen(offlineQueueFilePrefixes[i]))) {
+                std::string path = MO_FILENAME_PREFIX;
+                path += fname;
+                size_t size = 0;
+                if (filesystem->stat(path.c_str(), &size)) {
+                    filesOut++;
+                    bytesOut += size;
+                }
+                break;
+            }
+        }
+        return 0;
+    });
+}
+
+void OfflineStress::measureQueue() {
+    measureOfflineQueue(filesystem, queueFiles, queueBytes);
+
+    pendingCalls = traffic ? traffic->getPendingCalls() : 0;
+
+    peakFiles = std::max(peakFiles, queueFiles);
+    peakBytes = std::max(peakBytes, queueBytes);
+}
+
+bool OfflineStress::start(unsigned long durationS) {
+    if (!backoff || !traffic) {
+        MO_DBG_ERR("offline stress mode not set up");
+        return false;
+    }
+    if (state == State::Offline || state == State::Draining) {
+        MO_DBG_WARN("offline stress run already in progress");
+        return false;
+    }
+
+    measureQueue();
+    baselineFiles = queueFiles;
+    baselineBytes = queueBytes;
+    peakFiles = queueFiles;
+    peakBytes = queueBytes;
+    drainTime = 0;
+    flushedCalls = 0;
+
+    duration = durationS * 1000UL;
+    offlineSince = mocpp_tick_ms();
+    lastMeasurement = offlineSince;
+    state = State::Offline;
+    backoff->setOffline(OfflineSource::OfflineStress, true);
+
+    MO_DBG_INFO("go offline for %lu s", durationS);
+    return true;
+}
+
+void OfflineStress::loop() {
+    if (state != State::Offline && state != State::Draining) {
+        return;
+    }
+    if (!backoff || !traffic) {
+        return; //rebooting
+    }
+
+    unsigned long now = mocpp_tick_ms();
+
+    if (state == State::Offline && now - offlineSince >= duration) {
+        measureQueue();
+        MO_DBG_INFO("back online, queue on disk: %zu files, %zu bytes", queueFiles, queueBytes);
+        backoff->setOffline(OfflineSource::OfflineStress, false);
+        reconnectedAt = now;
+        sentCallsAtReconnect = traffic->getSentCalls();
+        state = State::Draining;
+    }
+
+    if (now - lastMeasurement < OFFLINE_MEASUREMENT_INTERVAL) {
+        return;
+    }
+    lastMeasurement = now;
+
+    unsigned long flushedCallsPrev = flushedCalls;
+
+    measureQueue();
+
+    if (state == State::Draining) {
+        flushedCalls = traffic->getSentCalls() - sentCallsAtReconnect;
+        if (flushedCalls != flushedCallsPrev) {
+            drainTime = now - reconnectedAt; //last activity of the flush
+        } else if (flushedCalls > 0 && pendingCalls == 0 && now - reconnectedAt - drainTime >= OFFLINE_DRAIN_QUIET_PERIOD) {
+            state = State::Drained;
+            MO_DBG_INFO("queue drained: %lu requests in %lu ms", flushedCalls, drainTime);
+        }
+    }
+}
+
+int OfflineStress::writeStatusJson(char *buf, size_t size) {
+    StaticJsonDocument<512> doc;
+    doc["state"] = cstrFromOfflineStressState(state);
+    doc["duration"] = duration / 1000UL;
+    if (state == State::Offline) {
+        doc["offlineRemaining"] = (duration - std::min(duration, mocpp_tick_ms() - offlineSince)) / 1000UL;
+    }
+    JsonObject queue = doc.createNestedObject("queue");
+    queue["files"] = queueFiles;
+    queue["bytes"] = queueBytes;
+    queue["baselineFiles"] = baselineFiles;
+    queue["baselineBytes"] = baselineBytes;
+    queue["peakFiles"] = peakFiles;
+    queue["peakBytes"] = peakBytes;
+    queue["pendingRequests"] = pendingCalls;
+    if (state == State::Draining || state == State::Drained) {
+        doc["flushedRequests"] = flushedCalls;
+        doc["timeToDrainMs"] = drainTime;
+        doc["flushThroughput"] = drainTime > 0 ? (float) flushedCalls * 1000.f / (float) drainTime : 0.f; //requests per second
+    }
+    if (traffic) {
+        doc["sentRequestsPerSecond"] = traffic->getSentCallsPerSecond();
+    }
+    if (doc.overflowed()) {
+        return -1;
+    }
+    if (measureJson(doc) >= size) {
+        return (int) measureJson(doc);
+    }
+    return (int) serializeJson(doc, buf, size);
+}
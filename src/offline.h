@@ -0,0 +1,67 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_OFFLINE_H
+#define MO_SIM_OFFLINE_H
+
+#include <memory>
+#include <cstddef>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+class ReconnectBackoff;
+class TrafficMeter;
+
+/*
+ * Offline queue stress mode: takes the charger offline for a given duration while the
+ * EVSEs keep charging and metering, reconnects and measures how fast the backlog drains
+ */
+class OfflineStress {
+public:
+    enum class State {
+        Idle,
+        Offline,
+        Draining,
+        Drained
+    };
+private:
+    ReconnectBackoff *backoff = nullptr;
+    TrafficMeter *traffic = nullptr;
+    std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem;
+
+    State state = State::Idle;
+    unsigned long duration = 0; //offline duration in ms
+    unsigned long offlineSince = 0;
+    unsigned long reconnectedAt = 0;
+    unsigned long drainTime = 0;
+    unsigned long lastMeasurement = 0;
+
+    size_t baselineFiles = 0, baselineBytes = 0; //queue on disk before going offline
+    size_t queueFiles = 0, queueBytes = 0; //current queue on disk
+    size_t peakFiles = 0, peakBytes = 0;
+    unsigned long pendingCalls = 0; //requests sent on the current connection which the server hasn't confirmed yet
+
+    unsigned long sentCallsAtReconnect = 0;
+    unsigned long flushedCalls = 0;
+
+    void measureQueue();
+public:
+    void setup(ReconnectBackoff *backoff, TrafficMeter *traffic, std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem);
+
+    bool start(unsigned long durationS);
+
+    void loop();
+
+    State getState() {return state;}
+
+    int writeStatusJson(char *buf, size_t size);
+};
+
+const char *cstrFromOfflineStressState(OfflineStress::State state);
+
+//measures the transactions and meter data which MicroOcpp keeps on the filesystem until the server has confirmed them
+void measureOfflineQueue(std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem, size_t& filesOut, size_t& bytesOut);
+
+extern OfflineStress offlineStress;
+
+#endif
@@ -0,0 +1,197 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "profile.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <time.h>
+#include <MicroOcpp/Platform.h>
+
+#include "traffic.h"
+
+//constant-initialized, so it's valid before any dynamic initialization. operator new can run
+//before the profiler has been constructed, because the order across translation units is unspecified
+static bool profilerConstructed = false;
+
+LoopProfiler::LoopProfiler() {
+    profilerConstructed = true;
+}
+
+#if MO_SIM_PROFILE_ALLOC
+
+void *operator new(size_t size) {
+    if (profilerConstructed) {
+        profiler.onAlloc(size);
+    }
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+#endif //MO_SIM_PROFILE_ALLOC
+
+uint64_t LoopProfiler::now() {
+#if defined(CLOCK_THREAD_CPUTIME_ID) && !defined(__EMSCRIPTEN__)
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL;
+#else
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+unsigned int LoopProfiler::slot(LoopPhase phase, unsigned int connectorId) {
+    if (phase == LoopPhase::Evse) {
+        unsigned int slot = (unsigned int) LoopPhase::Evse + connectorId - 1;
+        return slot < MO_SIM_PROFILE_SLOTS ? slot : (unsigned int) LoopPhase::Evse;
+    }
+    return (unsigned int) phase;
+}
+
+const char *LoopProfiler::slotName(unsigned int slot) {
+    switch (slot) {
+        case (unsigned int) LoopPhase::NetPoll:
+            return "netPoll";
+        case (unsigned int) LoopPhase::MicroOcpp:
+            return "microOcpp";
+        case (unsigned int) LoopPhase::Persistence:
+            return "persistence";
+        case (unsigned int) LoopPhase::Simulator:
+            return "simulator";
+    }
+    return "evse";
+}
+
+unsigned int LoopProfiler::enter(unsigned int slot, uint64_t& startOut) {
+    auto t = now();
+    total[current].time += t - mark;
+    window[current].time += t - mark;
+    unsigned int parent = current;
+    current = slot;
+    mark = t;
+    startOut = t;
+    return parent;
+}
+
+void LoopProfiler::leave(unsigned int slot, unsigned int parent, uint64_t start) {
+    auto t = now();
+    for (auto stats : {&total[slot], &window[slot]}) {
+        stats->time += t - mark;
+        stats->runs++;
+        if (t - start > stats->maxTime) {
+            stats->maxTime = (uint32_t) (t - start);
+        }
+    }
+    current = parent;
+    mark = t;
+}
+
+void LoopProfiler::loop() {
+    loops++;
+    windowLoops++;
+
+    if (MO_SIM_PROFILE_LOG_INTERVAL == 0 || mocpp_tick_ms() - lastLog < MO_SIM_PROFILE_LOG_INTERVAL) {
+        return;
+    }
+    lastLog = mocpp_tick_ms();
+
+    uint64_t sum = 0;
+    unsigned long allocs = 0;
+    for (auto& stats : window) {
+        sum += stats.time;
+        allocs += stats.allocs;
+    }
+
+    //the line grows with the number of EVSEs, so assemble it piecewise
+    std::string line;
+    line.reserve(128 + 24 * MO_SIM_PROFILE_SLOTS);
+    char part [64];
+    snprintf(part, sizeof(part), "[Sim] Profile: %lu loops, %.1f us/loop |",
+            windowLoops, windowLoops ? (double) sum / (double) windowLoops : 0.);
+    line += part;
+    for (unsigned int i = 0; i < MO_SIM_PROFILE_SLOTS; i++) {
+        //%.0u omits the connector id 0 of the non-EVSE phases
+        snprintf(part, sizeof(part), " %s%.0u %.1f%%",
+                slotName(i), i >= (unsigned int) LoopPhase::Evse ? i - (unsigned int) LoopPhase::Evse + 1 : 0,
+                sum ? 100. * (double) window[i].time / (double) sum : 0.);
+        line += part;
+    }
+    snprintf(part, sizeof(part), " | %lu allocs | %lu msgs out, %lu in",
+            allocs, traffic ? traffic->getSentCalls() : 0UL, traffic ? traffic->getRecvCalls() : 0UL);
+    line += part;
+    printf("%s\n", line.c_str());
+
+    window = std::array<Stats, MO_SIM_PROFILE_SLOTS>();
+    windowLoops = 0;
+}
+
+void LoopProfiler::reset() {
+    total = std::array<Stats, MO_SIM_PROFILE_SLOTS>();
+    window = std::array<Stats, MO_SIM_PROFILE_SLOTS>();
+    loops = 0;
+    windowLoops = 0;
+    since = mocpp_tick_ms();
+    mark = now();
+}
+
+unsigned long LoopProfiler::getAllocs() {
+    unsigned long allocs = 0;
+    for (auto& stats : total) {
+        allocs += stats.allocs;
+    }
+    return allocs;
+}
+
+uint64_t LoopProfiler::getAllocBytes() {
+    uint64_t allocBytes = 0;
+    for (auto& stats : total) {
+        allocBytes += stats.allocBytes;
+    }
+    return allocBytes;
+}
+
+int LoopProfiler::writeJson(char *buf, size_t size) {
+    uint64_t sum = 0;
+    for (auto& stats : total) {
+        sum += stats.time;
+    }
+
+    int written = snprintf(buf, size, "{\"duration\":%lu,\"loops\":%lu,\"cpuTime\":%llu,\"phases\":[",
+            mocpp_tick_ms() - since, loops, (unsigned long long) sum);
+
+    for (unsigned int i = 0; i < MO_SIM_PROFILE_SLOTS; i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        auto& stats = total[i];
+        written += snprintf(buf + written, size - written,
+                "%s{\"name\":\"%s\",\"connectorId\":%u,\"time\":%llu,\"share\":%.1f,\"perLoop\":%.1f,\"max\":%u,\"runs\":%lu,\"allocs\":%lu,\"allocBytes\":%llu}",
+                i ? "," : "", slotName(i),
+                i >= (unsigned int) LoopPhase::Evse ? i - (unsigned int) LoopPhase::Evse + 1 : 0,
+                (unsigned long long) stats.time,
+                sum ? 100. * (double) stats.time / (double) sum : 0.,
+                loops ? (double) stats.time / (double) loops : 0.,
+                (unsigned int) stats.maxTime, stats.runs, stats.allocs, (unsigned long long) stats.allocBytes);
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written,
+            "],\"messages\":{\"sentCalls\":%lu,\"recvCalls\":%lu,\"sentBytes\":%lu,\"recvBytes\":%lu}}",
+            traffic ? traffic->getSentCalls() : 0UL, traffic ? traffic->getRecvCalls() : 0UL,
+            traffic ? traffic->getSentBytes() : 0UL, traffic ? traffic->getRecvBytes() : 0UL);
+    return written;
+}
@@ -0,0 +1,104 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_PROFILE_H
+#define MO_SIM_PROFILE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef MO_SIM_PROFILE_LOG_INTERVAL
+#define MO_SIM_PROFILE_LOG_INTERVAL 60000UL //print a profile line every interval ms. 0 disables the log
+#endif
+
+#ifndef MO_SIM_PROFILE_ALLOC
+#define MO_SIM_PROFILE_ALLOC 0 //count operator new calls per phase. Replaces the global operator new. For the heap usage, use MO_ENABLE_HEAP_PROFILER
+#endif
+
+#define MO_SIM_PROFILE_SLOTS (4 + MO_NUMCONNECTORS - 1)
+
+enum class LoopPhase {
+    NetPoll,     //socket and HTTP API
+    MicroOcpp,   //mocpp_loop()
+    Persistence, //journal and RAM filesystem
+    Simulator,   //everything else, e.g. offline runs and fault injection
+    Evse         //Evse::loop(), one slot per connector
+};
+
+/*
+ * Accounts the CPU time, allocations and allocated bytes per loop phase. Phases nest: the time of
+ * an inner phase is not counted for the outer phase. Each phase change reads the thread CPU clock
+ * once
+ */
+class LoopProfiler {
+public:
+    struct Stats {
+        uint64_t time = 0; //in us
+        uint32_t maxTime = 0; //longest single run in us
+        unsigned long runs = 0;
+        unsigned long allocs = 0;
+        uint64_t allocBytes = 0;
+    };
+private:
+    std::array<Stats, MO_SIM_PROFILE_SLOTS> total;
+    std::array<Stats, MO_SIM_PROFILE_SLOTS> window; //since the previous log line
+
+    unsigned int current = (unsigned int) LoopPhase::Simulator;
+    uint64_t mark = 0;
+    unsigned long loops = 0, windowLoops = 0;
+    unsigned long lastLog = 0;
+    unsigned long since = 0;
+
+    friend class ProfileScope;
+    unsigned int enter(unsigned int slot, uint64_t& startOut);
+    void leave(unsigned int slot, unsigned int parent, uint64_t start);
+public:
+    LoopProfiler();
+
+    static uint64_t now();
+
+    static unsigned int slot(LoopPhase phase, unsigned int connectorId = 1);
+    static const char *slotName(unsigned int slot);
+
+    void onAlloc(size_t size) {
+        total[current].allocs++;
+        total[current].allocBytes += size;
+        window[current].allocs++;
+        window[current].allocBytes += size;
+    }
+
+    //count one main loop iteration and print the log line if due
+    void loop();
+
+    //clears the statistics. Called once at startup to set the time base
+    void reset();
+
+    //allocations since the last reset, summed over all phases
+    unsigned long getAllocs();
+    uint64_t getAllocBytes();
+
+    int writeJson(char *buf, size_t size);
+};
+
+extern LoopProfiler profiler;
+
+/*
+ * Accounts the time until the end of the scope to the given phase
+ */
+class ProfileScope {
+private:
+    unsigned int slot;
+    unsigned int parent;
+    uint64_t start;
+public:
+    ProfileScope(LoopPhase phase, unsigned int connectorId = 1) : slot(LoopProfiler::slot(phase, connectorId)) {
+        parent = profiler.enter(slot, start);
+    }
+    ~ProfileScope() {
+        profiler.leave(slot, parent, start);
+    }
+};
+
+#endif
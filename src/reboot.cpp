@@ -0,0 +1,68 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "reboot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "evse.h"
+#include "startup.h"
+
+void SimReboot::declareConfigurations() {
+    delayInt = MicroOcpp::declareConfiguration<int>("rebootDelay", MO_SIM_REBOOT_DELAY, SIMULATOR_FN, false, false, false);
+}
+
+void SimReboot::request(bool isHard) {
+    requested = true;
+    requestedHard = isHard;
+}
+
+void SimReboot::begin() {
+    requested = false;
+    rebooting = true;
+    hard = requestedHard;
+    rebootStart = mocpp_tick_ms();
+    if (hard) {
+        hardResets++;
+    } else {
+        softResets++;
+    }
+
+    //measure the startup phases from the Reset
+    startupStats = SimStartupStats();
+    startupStats.start = rebootStart;
+
+    printf("[Sim] %s reset, reboot in %i ms\n", hard ? "Hard" : "Soft", getDelay());
+}
+
+bool SimReboot::isDelayElapsed() {
+    return rebooting && mocpp_tick_ms() - rebootStart >= (unsigned long) getDelay();
+}
+
+void SimReboot::end() {
+    rebooting = false;
+}
+
+int SimReboot::getDelay() {
+    return delayInt ? std::max(0, delayInt->getInt()) : MO_SIM_REBOOT_DELAY;
+}
+
+void SimReboot::setDelay(int delay) {
+    if (!delayInt || delayInt->getInt() == delay) return;
+    delayInt->setInt(delay);
+    MicroOcpp::configuration_save();
+}
+
+int SimReboot::writeStatusJson(char *buf, size_t size) {
+    return snprintf(buf, size,
+            "{\"delay\":%i,\"rebooting\":%s,\"softResets\":%lu,\"hardResets\":%lu,\"lastReset\":%s}",
+            getDelay(),
+            rebooting ? "true" : "false",
+            softResets,
+            hardResets,
+            softResets + hardResets == 0 ? "null" : hard ? "\"Hard\"" : "\"Soft\"");
+}
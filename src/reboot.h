@@ -0,0 +1,57 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_REBOOT_H
+#define MO_SIM_REBOOT_H
+
+#include <cstddef>
+#include <memory>
+#include <MicroOcpp/Core/Configuration.h>
+
+#ifndef MO_SIM_REBOOT_DELAY
+#define MO_SIM_REBOOT_DELAY 2000 //default time in ms which the charger is off during a simulated reboot
+#endif
+
+/*
+ * Simulated reboot after an OCPP Reset. The Reset callback runs inside mocpp_loop(), so it only
+ * requests the reboot. The main loop then deinitializes MicroOcpp and closes the connection,
+ * stays off for the reboot delay and initializes again from the persisted state. The startup
+ * stats are measured from the Reset, so /startup reports how long the charger took to be
+ * accepted by the server again
+ */
+class SimReboot {
+private:
+    std::shared_ptr<MicroOcpp::Configuration> delayInt; //in ms
+
+    bool requested = false;
+    bool requestedHard = false;
+    bool rebooting = false;
+    bool hard = false;
+    unsigned long rebootStart = 0;
+
+    unsigned long softResets = 0;
+    unsigned long hardResets = 0;
+public:
+    //declare the settings. Must be called before loading SIMULATOR_FN
+    void declareConfigurations();
+
+    //called from the Reset callback
+    void request(bool isHard);
+    bool isRequested() {return requested;}
+
+    //the charger is off from begin() until the delay has elapsed
+    void begin();
+    bool isRebooting() {return rebooting;}
+    bool isDelayElapsed();
+    void end();
+
+    int getDelay();
+    void setDelay(int delay);
+
+    int writeStatusJson(char *buf, size_t size);
+};
+
+extern SimReboot simReboot;
+
+#endif
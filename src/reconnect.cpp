@@ -0,0 +1,186 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "reconnect.h"
+
+#include <cstring>
+#include <algorithm>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#define MO_SIM_RECONNECT_BASE_DEFAULT_MS 1000UL //base delay if ReconnectInterval is 0 but a backoff strategy is set
+
+const char *cstrFromReconnectStrategy(ReconnectStrategy strategy) {
+    switch (strategy) {
+        case ReconnectStrategy::Fixed:
+            return "Fixed";
+        case ReconnectStrategy::Exponential:
+            return "Exponential";
+        case ReconnectStrategy::FullJitter:
+            return "FullJitter";
+        case ReconnectStrategy::DecorrelatedJitter:
+            return "DecorrelatedJitter";
+    }
+    return "Fixed";
+}
+
+bool parseReconnectStrategy(const char *cstr, ReconnectStrategy& out) {
+    if (!cstr) {
+        return false;
+    }
+    if (!strcmp(cstr, "Fixed")) {
+        out = ReconnectStrategy::Fixed;
+    } else if (!strcmp(cstr, "Exponential")) {
+        out = ReconnectStrategy::Exponential;
+    } else if (!strcmp(cstr, "FullJitter")) {
+        out = ReconnectStrategy::FullJitter;
+    } else if (!strcmp(cstr, "DecorrelatedJitter")) {
+        out = ReconnectStrategy::DecorrelatedJitter;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ReconnectBackoff::ReconnectBackoff() : rng{std::random_device{}()} {
+
+}
+
+void ReconnectBackoff::setup(std::shared_ptr<MicroOcpp::Configuration> reconnectIntervalInt, const char *filename) {
+    this->reconnectIntervalInt = reconnectIntervalInt;
+
+    strategyString = MicroOcpp::declareConfiguration<const char*>(MO_CONFIG_EXT_PREFIX "ReconnectStrategy", "Fixed", filename);
+    maxIntervalInt = MicroOcpp::declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "ReconnectMaxInterval", 300, filename);
+    rampUpInt = MicroOcpp::declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "ReconnectRampUp", 0, filename);
+
+    MicroOcpp::configuration_load(filename);
+
+    startTime = mocpp_tick_ms();
+    rampUpDelay = randomBetween(0, (unsigned long) getRampUp() * 1000UL);
+    if (rampUpDelay > 0) {
+        MO_DBG_INFO("ramp-up: first connection attempt in %lu ms", rampUpDelay);
+    }
+}
+
+unsigned long ReconnectBackoff::getBaseMs() {
+    if (reconnectIntervalInt && reconnectIntervalInt->getInt() > 0) {
+        return (unsigned long) reconnectIntervalInt->getInt() * 1000UL;
+    }
+    return getStrategy() == ReconnectStrategy::Fixed ? 0UL : MO_SIM_RECONNECT_BASE_DEFAULT_MS;
+}
+
+unsigned long ReconnectBackoff::getMaxMs() {
+    return std::max(getBaseMs(), (unsigned long) getMaxInterval() * 1000UL);
+}
+
+unsigned long ReconnectBackoff::randomBetween(unsigned long lower, unsigned long upper) {
+    if (upper <= lower) {
+        return lower;
+    }
+    return std::uniform_int_distribution<unsigned long>{lower, upper}(rng);
+}
+
+unsigned long ReconnectBackoff::calculateDelay() {
+    unsigned long base = getBaseMs();
+    unsigned long cap = getMaxMs();
+
+    switch (getStrategy()) {
+        case ReconnectStrategy::Fixed:
+            return base;
+        case ReconnectStrategy::Exponential:
+        case ReconnectStrategy::FullJitter: {
+            unsigned long exp = base;
+            for (unsigned int i = 0; i < failedAttempts && exp < cap; i++) {
+                exp *= 2;
+            }
+            exp = std::min(exp, cap);
+            return getStrategy() == ReconnectStrategy::Exponential ? exp : randomBetween(base, exp);
+        }
+        case ReconnectStrategy::DecorrelatedJitter:
+            return std::min(cap, randomBetween(base, std::max(base, delay) * 3));
+    }
+    return base;
+}
+
+bool ReconnectBackoff::allowAttempt() {
+    if (isOffline()) {
+        return false;
+    }
+
+    unsigned long now = mocpp_tick_ms();
+
+    if (!hasAttempted) {
+        if (now - startTime < rampUpDelay) {
+            return false;
+        }
+    } else if (now - lastAttempt < delay) {
+        return false;
+    }
+
+    if (hasAttempted) {
+        failedAttempts++; //previous attempt didn't succeed, otherwise onConnected() would have reset the backoff
+    }
+
+    hasAttempted = true;
+    lastAttempt = now;
+    delay = calculateDelay();
+    attemptRate.add();
+
+    MO_DBG_DEBUG("connection attempt %u, next one in %lu ms", failedAttempts + 1, delay);
+    return true;
+}
+
+void ReconnectBackoff::onConnected() {
+    failedAttempts = 0;
+    delay = getBaseMs();
+}
+
+void ReconnectBackoff::setOffline(OfflineSource source, bool offline) {
+    unsigned int holds = offline ?
+            offlineHolds | (unsigned int) source :
+            offlineHolds & ~(unsigned int) source;
+    if (offlineHolds && !holds) {
+        //back online: the outage doesn't count as failed attempts, connect right away
+        failedAttempts = 0;
+        delay = 0;
+    }
+    offlineHolds = holds;
+}
+
+ReconnectStrategy ReconnectBackoff::getStrategy() {
+    ReconnectStrategy strategy = ReconnectStrategy::Fixed;
+    if (strategyString && !parseReconnectStrategy(strategyString->getString(), strategy)) {
+        strategy = ReconnectStrategy::Fixed;
+    }
+    return strategy;
+}
+
+bool ReconnectBackoff::setStrategy(const char *strategy) {
+    ReconnectStrategy parsed;
+    if (!strategyString || !parseReconnectStrategy(strategy, parsed)) {
+        return false;
+    }
+    strategyString->setString(strategy);
+    return true;
+}
+
+void ReconnectBackoff::setMaxInterval(int maxIntervalS) {
+    if (maxIntervalInt && maxIntervalS >= 0) {
+        maxIntervalInt->setInt(maxIntervalS);
+    }
+}
+
+int ReconnectBackoff::getMaxInterval() {
+    return maxIntervalInt ? maxIntervalInt->getInt() : 0;
+}
+
+void ReconnectBackoff::setRampUp(int rampUpS) {
+    if (rampUpInt && rampUpS >= 0) {
+        rampUpInt->setInt(rampUpS);
+    }
+}
+
+int ReconnectBackoff::getRampUp() {
+    return rampUpInt && rampUpInt->getInt() > 0 ? rampUpInt->getInt() : 0;
+}
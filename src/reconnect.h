@@ -0,0 +1,87 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_RECONNECT_H
+#define MO_SIM_RECONNECT_H
+
+#include <memory>
+#include <random>
+#include <MicroOcpp/Core/Configuration.h>
+
+#include "stats.h"
+
+enum class ReconnectStrategy {
+    Fixed,              //wait ReconnectInterval between two attempts (MicroOcpp default behavior)
+    Exponential,        //double the delay after each failed attempt, up to ReconnectMaxInterval
+    FullJitter,         //random delay between ReconnectInterval and the exponential delay
+    DecorrelatedJitter, //random delay between ReconnectInterval and 3x the previous delay
+};
+
+//features which can hold the connection offline. Each one releases only its own hold
+enum class OfflineSource : unsigned int {
+    OfflineStress = 1 << 0,
+    Fault = 1 << 1,
+};
+
+const char *cstrFromReconnectStrategy(ReconnectStrategy strategy);
+bool parseReconnectStrategy(const char *cstr, ReconnectStrategy& out);
+
+/*
+ * Decides when the WebSocket may start the next connection attempt. ReconnectInterval
+ * remains the lower bound between two attempts; the strategies only stretch it. The
+ * ramp-up delays the very first attempt by a random share of ReconnectRampUp so that a
+ * fleet which is started at once doesn't connect in lockstep
+ */
+class ReconnectBackoff {
+private:
+    std::shared_ptr<MicroOcpp::Configuration> reconnectIntervalInt; //base delay in s
+    std::shared_ptr<MicroOcpp::Configuration> strategyString;
+    std::shared_ptr<MicroOcpp::Configuration> maxIntervalInt; //upper bound of the delay in s
+    std::shared_ptr<MicroOcpp::Configuration> rampUpInt; //spread of the first attempt in s
+
+    std::minstd_rand rng;
+
+    bool hasAttempted = false;
+    unsigned long rampUpDelay = 0;
+    unsigned long startTime = 0;
+    unsigned long lastAttempt = 0;
+    unsigned long delay = 0; //current delay in ms
+    unsigned int failedAttempts = 0;
+
+    unsigned int offlineHolds = 0; //OfflineSource bits which hold the connection closed, e.g. for simulating an outage
+
+    RateCounter attemptRate;
+
+    unsigned long getBaseMs();
+    unsigned long getMaxMs();
+    unsigned long randomBetween(unsigned long lower, unsigned long upper);
+    unsigned long calculateDelay();
+public:
+    ReconnectBackoff();
+
+    void setup(std::shared_ptr<MicroOcpp::Configuration> reconnectIntervalInt, const char *filename);
+
+    //returns true if a closed connection may try to connect now; counts the attempt
+    bool allowAttempt();
+
+    //resets the backoff after a successful connection
+    void onConnected();
+
+    ReconnectStrategy getStrategy();
+    bool setStrategy(const char *strategy);
+    void setMaxInterval(int maxIntervalS);
+    int getMaxInterval();
+    void setRampUp(int rampUpS);
+    int getRampUp();
+
+    //closes the connection and suspends all attempts until every source has released its hold
+    void setOffline(OfflineSource source, bool offline);
+    bool isOffline() {return offlineHolds != 0;}
+
+    unsigned long getAttempts() {return attemptRate.getTotal();}
+    float getAttemptsPerSecond() {return attemptRate.perSecond();}
+    unsigned int getFailedAttempts() {return failedAttempts;}
+};
+
+#endif
@@ -0,0 +1,91 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "sampling.h"
+
+#include <MicroOcpp/Platform.h>
+
+void MeterSampler::loop(unsigned long interval, unsigned int connectorId, float power, float voltage, int numberPhases) {
+    if (interval == 0 || (sampleCount > 0 && mocpp_tick_ms() - lastSample < interval)) {
+        return;
+    }
+    lastSample = mocpp_tick_ms();
+
+    if (numberPhases < 1 || numberPhases > 3) {
+        numberPhases = 3;
+    }
+
+    auto& sample = samples[sampleCount % MO_SIM_SAMPLES_MAX];
+    sample.time = lastSample;
+    sample.values[Power] = power;
+
+    int firstPhase = (connectorId - 1) % 3; //same phase rotation as the site model
+    for (int i = 0; i < 3; i++) {
+        sample.values[CurrentL1 + i] = 0.f;
+        //small per-phase asymmetry of the grid voltage
+        sample.values[VoltageL1 + i] = voltage > 0.f ? voltage + (float) (((lastSample / 1000 + i * 7) * 2654435761UL) % 3000) * 0.001f - 1.5f : 0.f;
+    }
+    for (int i = 0; i < numberPhases; i++) {
+        int phase = (firstPhase + i) % 3;
+        float phaseVoltage = sample.values[VoltageL1 + phase];
+        sample.values[CurrentL1 + phase] = phaseVoltage > 0.f ? power / ((float) numberPhases * phaseVoltage) : 0.f;
+    }
+
+    sampleCount++;
+}
+
+MeterSampler::Aggregate MeterSampler::aggregate(Field field, unsigned long begin) {
+    if (sampleCount > MO_SIM_SAMPLES_MAX && begin < sampleCount - MO_SIM_SAMPLES_MAX) {
+        begin = sampleCount - MO_SIM_SAMPLES_MAX; //older samples have been overwritten
+    }
+
+    Aggregate res;
+    float sum = 0.f;
+    for (unsigned long n = begin; n < sampleCount; n++) {
+        float value = samples[n % MO_SIM_SAMPLES_MAX].values[field];
+        if (res.count == 0 || value < res.min) {
+            res.min = value;
+        }
+        if (res.count == 0 || value > res.max) {
+            res.max = value;
+        }
+        sum += value;
+        res.count++;
+    }
+    if (res.count > 0) {
+        res.avg = sum / (float) res.count;
+    }
+    return res;
+}
+
+MeterSampler::Aggregate MeterSampler::window(Field field, unsigned long windowMs) {
+    unsigned long begin = sampleCount;
+    unsigned long now = mocpp_tick_ms();
+    while (begin > 0 &&
+            sampleCount - begin < MO_SIM_SAMPLES_MAX &&
+            now - samples[(begin - 1) % MO_SIM_SAMPLES_MAX].time <= windowMs) {
+        begin--;
+    }
+    return aggregate(field, begin);
+}
+
+MeterSampler::Aggregate MeterSampler::interval(Field field, unsigned long intervalMs) {
+    auto res = window(field, intervalMs);
+    if (res.count == 0 && sampleCount > 0) {
+        //no sample in the interval, repeat the latest one
+        res.avg = res.min = res.max = samples[(sampleCount - 1) % MO_SIM_SAMPLES_MAX].values[field];
+    }
+    return res;
+}
+
+const float *MeterSampler::getSample(unsigned long n, unsigned long *timeOut) {
+    if (n >= sampleCount || sampleCount - n > MO_SIM_SAMPLES_MAX) {
+        return nullptr;
+    }
+    auto& sample = samples[n % MO_SIM_SAMPLES_MAX];
+    if (timeOut) {
+        *timeOut = sample.time;
+    }
+    return sample.values;
+}
@@ -0,0 +1,69 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_SAMPLING_H
+#define MO_SIM_SAMPLING_H
+
+#include <array>
+#include <cstddef>
+
+#ifndef MO_SIM_SAMPLES_MAX
+#define MO_SIM_SAMPLES_MAX 600 //capacity of the sample ring buffer per connector
+#endif
+
+#define MO_SIM_SAMPLE_FIELDS 7
+
+/*
+ * High-rate meter sampling of one connector. The simulated readings are sampled into a ring
+ * buffer at a configurable interval, independent of MicroOcpp's MeterValueSampleInterval. The
+ * per-phase MeterValue inputs report the average over the last OCPP sampling interval, so every
+ * evaluation within the same interval reads the same aggregate. The samples themselves can be
+ * sent in batches with one timestamped MeterValue per sample
+ */
+class MeterSampler {
+public:
+    enum Field {
+        Power,
+        CurrentL1,
+        CurrentL2,
+        CurrentL3,
+        VoltageL1,
+        VoltageL2,
+        VoltageL3
+    };
+
+    struct Aggregate {
+        float avg = 0.f;
+        float min = 0.f;
+        float max = 0.f;
+        unsigned int count = 0;
+    };
+private:
+    struct Sample {
+        unsigned long time;
+        float values [MO_SIM_SAMPLE_FIELDS];
+    };
+
+    std::array<Sample, MO_SIM_SAMPLES_MAX> samples; //sample n at index n % MO_SIM_SAMPLES_MAX
+    unsigned long sampleCount = 0;
+    unsigned long lastSample = 0;
+
+    Aggregate aggregate(Field field, unsigned long begin);
+public:
+    //takes a sample if interval ms have passed. interval 0 disables sampling
+    void loop(unsigned long interval, unsigned int connectorId, float power, float voltage, int numberPhases);
+
+    //aggregates the samples of the last windowMs
+    Aggregate window(Field field, unsigned long windowMs);
+
+    //aggregates the samples of the last intervalMs, or repeats the latest sample if there is none
+    Aggregate interval(Field field, unsigned long intervalMs);
+
+    //returns the values of sample number n, or nullptr if it has been overwritten already
+    const float *getSample(unsigned long n, unsigned long *timeOut);
+
+    unsigned long getSampleCount() {return sampleCount;}
+};
+
+#endif
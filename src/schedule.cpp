@@ -0,0 +1,119 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "schedule.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <MicroOcpp/Core/Context.h>
+#include <MicroOcpp/Model/Model.h>
+#include <MicroOcpp/Model/SmartCharging/SmartChargingService.h>
+#include <MicroOcpp/Debug.h>
+
+ScheduleTimeline::ScheduleTimeline(unsigned int connectorId) : connectorId{connectorId} {
+
+}
+
+void ScheduleTimeline::reset() {
+    origin = MicroOcpp::Timestamp();
+    starts.clear();
+    periods.clear();
+    valid = false;
+    dirty = true;
+}
+
+void ScheduleTimeline::loop() {
+    auto context = getOcppContext();
+    if (!context) {
+        return;
+    }
+    auto& now = context->getModel().getClock().now();
+    if (now < MicroOcpp::MIN_TIME) {
+        return; //wait until the clock is set
+    }
+
+    if (dirty ||
+            mocpp_tick_ms() - lastRefresh >= MO_SIM_SCHEDULE_REFRESH_INTERVAL ||
+            (valid && now - origin >= MO_SIM_SCHEDULE_HORIZON / 2)) {
+        refresh();
+    }
+}
+
+bool ScheduleTimeline::refresh() {
+    dirty = false;
+    lastRefresh = mocpp_tick_ms();
+
+    auto context = getOcppContext();
+    auto scService = context ? context->getModel().getSmartChargingService() : nullptr;
+    if (!scService) {
+        valid = false;
+        return false;
+    }
+
+    auto schedule = scService->getCompositeSchedule(connectorId, MO_SIM_SCHEDULE_HORIZON, MicroOcpp::ChargingRateUnitType_Optional::Watt);
+    if (!schedule) {
+        MO_DBG_WARN("cannot compute composite schedule for connector %u", connectorId);
+        valid = false;
+        return false;
+    }
+
+    origin = schedule->startSchedule;
+    starts.clear();
+    periods.clear();
+    for (auto& period : schedule->chargingSchedulePeriod) {
+        if (!periods.empty() && periods.back().limit == period.limit && periods.back().numberPhases == period.numberPhases) {
+            continue; //merge adjacent periods with the same limit
+        }
+        starts.push_back(period.startPeriod);
+        periods.push_back(Period {period.startPeriod, period.limit, period.numberPhases});
+    }
+
+    valid = true;
+    MO_DBG_DEBUG("connector %u: composite schedule with %zu periods", connectorId, periods.size());
+    return true;
+}
+
+bool ScheduleTimeline::getLimit(const MicroOcpp::Timestamp& t, float& limitOut, int *numberPhasesOut) const {
+    if (!valid || t < origin) {
+        return false;
+    }
+    int offset = t - origin;
+    if (offset >= MO_SIM_SCHEDULE_HORIZON) {
+        return false;
+    }
+
+    //last period which starts at or before offset
+    auto it = std::upper_bound(starts.begin(), starts.end(), offset);
+    if (it == starts.begin()) {
+        return false;
+    }
+    auto& period = periods[(it - starts.begin()) - 1];
+    if (numberPhasesOut) {
+        *numberPhasesOut = period.numberPhases;
+    }
+    limitOut = period.limit;
+    return true;
+}
+
+int ScheduleTimeline::writeJson(char *buf, size_t size) const {
+    char originStr [MicroOcpp::JSONDATE_LENGTH + 1] = {'\0'};
+    origin.toJsonString(originStr, sizeof(originStr));
+
+    int written = snprintf(buf, size, "{\"connectorId\":%u,\"valid\":%s,\"startSchedule\":\"%s\",\"duration\":%i,\"chargingRateUnit\":\"W\",\"chargingSchedulePeriod\":[",
+            connectorId, valid ? "true" : "false", originStr, MO_SIM_SCHEDULE_HORIZON);
+
+    for (size_t i = 0; i < periods.size(); i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        written += snprintf(buf + written, size - written, "%s{\"startPeriod\":%i,\"limit\":%.1f,\"numberPhases\":%i}",
+                i ? "," : "", periods[i].start, periods[i].limit, periods[i].numberPhases);
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "]}");
+    return written;
+}
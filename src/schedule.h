@@ -0,0 +1,67 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_SCHEDULE_H
+#define MO_SIM_SCHEDULE_H
+
+#include <cstddef>
+#include <vector>
+#include <MicroOcpp/Core/Time.h>
+
+#ifndef MO_SIM_SCHEDULE_HORIZON
+#define MO_SIM_SCHEDULE_HORIZON 86400 //length of the precomputed timeline in s
+#endif
+
+#ifndef MO_SIM_SCHEDULE_REFRESH_INTERVAL
+#define MO_SIM_SCHEDULE_REFRESH_INTERVAL 60000UL //recompute after this time in ms, even if no profile has changed
+#endif
+
+/*
+ * Composite charging schedule of one connector, resolved into a piecewise constant timeline.
+ * The timeline is computed once from all installed ChargingProfiles and only recomputed after
+ * a profile change, after MO_SIM_SCHEDULE_REFRESH_INTERVAL, or when half of the horizon has
+ * passed. Looking up the limit at a point in time is a binary search over the period starts
+ */
+class ScheduleTimeline {
+public:
+    struct Period {
+        int start; //in s since the timeline origin
+        float limit; //in W
+        int numberPhases;
+    };
+private:
+    const unsigned int connectorId;
+
+    MicroOcpp::Timestamp origin;
+    std::vector<int> starts; //ascending, same order as periods
+    std::vector<Period> periods;
+
+    bool valid = false;
+    bool dirty = true;
+    unsigned long lastRefresh = 0;
+public:
+    ScheduleTimeline(unsigned int connectorId);
+
+    //marks the timeline as outdated, e.g. after SetChargingProfile
+    void invalidate() {dirty = true;}
+
+    //drops the timeline, e.g. when MicroOcpp is reinitialized and the old origin is meaningless
+    void reset();
+
+    //recomputes the timeline if outdated
+    void loop();
+
+    bool refresh();
+
+    //writes the limit in W at time t (negative if unlimited). Returns false if t is not covered by the timeline
+    bool getLimit(const MicroOcpp::Timestamp& t, float& limitOut, int *numberPhasesOut = nullptr) const;
+
+    const MicroOcpp::Timestamp& getOrigin() const {return origin;}
+    const std::vector<Period>& getPeriods() const {return periods;}
+    bool isValid() const {return valid;}
+
+    int writeJson(char *buf, size_t size) const;
+};
+
+#endif
@@ -0,0 +1,67 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "shutdown.h"
+
+#include <cstdio>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "evse.h"
+#include "offline.h"
+#include "traffic.h"
+
+void ShutdownDrain::declareConfigurations() {
+    timeoutInt = MicroOcpp::declareConfiguration<int>("drainTimeout", MO_SIM_DRAIN_TIMEOUT, SIMULATOR_FN, false, false, false);
+}
+
+void ShutdownDrain::setup(TrafficMeter *traffic, std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem) {
+    this->traffic = traffic;
+    this->filesystem = filesystem;
+}
+
+void ShutdownDrain::begin() {
+    if (draining) {
+        return;
+    }
+    draining = true;
+    drainStart = mocpp_tick_ms();
+    pendingAtStart = traffic ? traffic->getPendingCalls() : 0;
+    sentCallsAtStart = traffic ? traffic->getSentCalls() : 0;
+    lostCallsAtStart = traffic ? traffic->getLostCalls() : 0;
+    printf("[Sim] Draining: waiting for %lu pending requests\n", pendingAtStart);
+}
+
+bool ShutdownDrain::loop() {
+    if (!draining || aborted) {
+        return false;
+    }
+    if (!traffic || traffic->getPendingCalls() == 0) {
+        return false;
+    }
+    int timeout = timeoutInt ? timeoutInt->getInt() : MO_SIM_DRAIN_TIMEOUT;
+    if (timeout <= 0 || mocpp_tick_ms() - drainStart >= (unsigned long) timeout) {
+        return false;
+    }
+    return true;
+}
+
+void ShutdownDrain::report() {
+    unsigned long pending = traffic ? traffic->getPendingCalls() : 0;
+    unsigned long dropped = pending + (traffic ? traffic->getLostCalls() - lostCallsAtStart : 0);
+    unsigned long sentDuringDrain = traffic ? traffic->getSentCalls() - sentCallsAtStart : 0;
+    printf("[Sim] Drain %s after %lu ms: %lu requests pending at start, %lu sent during drain, %lu dropped\n",
+            aborted ? "aborted" : pending ? "timed out" : "complete",
+            mocpp_tick_ms() - drainStart,
+            pendingAtStart,
+            sentDuringDrain,
+            dropped);
+
+    size_t queueFiles = 0, queueBytes = 0;
+    measureOfflineQueue(filesystem, queueFiles, queueBytes);
+    printf("[Sim] Unsent queue on disk: %zu files, %zu bytes. MicroOcpp sends them after the restart\n", queueFiles, queueBytes);
+    if (dropped) {
+        MO_DBG_WARN("%lu requests without confirmation", dropped);
+    }
+}
@@ -0,0 +1,62 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_SHUTDOWN_H
+#define MO_SIM_SHUTDOWN_H
+
+#include <memory>
+#include <signal.h>
+#include <MicroOcpp/Core/Configuration.h>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+#ifndef MO_SIM_DRAIN_TIMEOUT
+#define MO_SIM_DRAIN_TIMEOUT 5000 //default time in ms to wait for the confirmations of pending requests at shutdown
+#endif
+
+class TrafficMeter;
+
+/*
+ * Bounded-time shutdown. After SIGINT or SIGTERM, the Simulator drains: the API
+ * refuses new calls with 503, the token and throughput workloads pause, and the main loop keeps
+ * running until the server has confirmed the pending OCPP requests or the drain timeout expires.
+ * Then the simulator state is saved. Requests which are still unconfirmed are reported as dropped.
+ * The transactions and meter data which MicroOcpp hasn't sent yet are reported separately. They
+ * are not lost, because MicroOcpp keeps them on the filesystem and sends them after the restart
+ */
+class ShutdownDrain {
+private:
+    TrafficMeter *traffic = nullptr;
+    std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem;
+    std::shared_ptr<MicroOcpp::Configuration> timeoutInt; //in ms, 0 skips the drain
+
+    bool draining = false;
+    volatile sig_atomic_t aborted = 0;
+    unsigned long drainStart = 0;
+    unsigned long pendingAtStart = 0;
+    unsigned long sentCallsAtStart = 0;
+    unsigned long lostCallsAtStart = 0;
+public:
+    //declare the settings. Must be called before loading SIMULATOR_FN
+    void declareConfigurations();
+
+    void setup(TrafficMeter *traffic, std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem);
+
+    void begin();
+
+    //ends the drain early. Safe to call from a signal handler
+    void abort() {aborted = 1;}
+    bool isAborted() {return aborted;}
+
+    //returns false once the drain is complete
+    bool loop();
+
+    //prints how the drain went. Call after the state has been saved
+    void report();
+
+    bool isDraining() {return draining;}
+};
+
+extern ShutdownDrain shutdownDrain;
+
+#endif
@@ -0,0 +1,166 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "site.h"
+
+#include <cstdio>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "evse.h"
+
+void SiteModel::declareConfigurations() {
+    capacityInt = MicroOcpp::declareConfiguration<int>("siteCapacity", 0, SIMULATOR_FN, false, false, false);
+    phaseCapacityInt = MicroOcpp::declareConfiguration<int>("sitePhaseCapacity", 0, SIMULATOR_FN, false, false, false);
+}
+
+void SiteModel::recomputeLoad() {
+    totalPower = 0.f;
+    phasePower.fill(0.f);
+
+    for (unsigned int i = 0; i < connectorPower.size(); i++) {
+        if (connectorPhases[i] <= 0) {
+            continue; //not reported yet
+        }
+        totalPower += connectorPower[i];
+
+        int firstPhase = i % MO_SIM_SITE_PHASES; //phase rotation
+        for (int p = 0; p < connectorPhases[i]; p++) {
+            phasePower[(firstPhase + p) % MO_SIM_SITE_PHASES] += connectorPower[i] / (float) connectorPhases[i];
+        }
+    }
+}
+
+void SiteModel::updatePower(unsigned int connectorId, float power, int numberPhases) {
+    if (connectorId < 1 || connectorId > connectorPower.size()) {
+        MO_DBG_ERR("invalid argument");
+        return;
+    }
+    if (numberPhases < 1 || numberPhases > MO_SIM_SITE_PHASES) {
+        numberPhases = MO_SIM_SITE_PHASES;
+    }
+
+    auto i = connectorId - 1;
+    if (connectorPower[i] == power && connectorPhases[i] == numberPhases) {
+        return;
+    }
+
+    connectorPower[i] = power;
+    connectorPhases[i] = numberPhases;
+    recomputeLoad();
+
+    if (totalPower > peakPower) {
+        peakPower = totalPower;
+    }
+
+    checkBreaches();
+}
+
+void SiteModel::checkBreaches() {
+    int capacity = getCapacity();
+    checkBreach(-1, totalPower, (float) capacity);
+    int phaseCapacity = getPhaseCapacity();
+    for (int phase = 0; phase < MO_SIM_SITE_PHASES; phase++) {
+        checkBreach(phase, phasePower[phase], (float) phaseCapacity);
+    }
+}
+
+unsigned long SiteModel::allocEvent() {
+    //the new event takes the slot of the oldest one. If that breach is still ongoing, it keeps its
+    //slot under the new number and the new event moves on to the next slot
+    for (;;) {
+        unsigned long n = eventCount++;
+        bool pinned = false;
+        for (auto& current : ongoing) {
+            if (current >= 0 && n - (unsigned long) current == MO_SIM_SITE_EVENTS_MAX) {
+                current = (long) n;
+                pinned = true;
+            }
+        }
+        if (!pinned) {
+            return n;
+        }
+    }
+}
+
+void SiteModel::checkBreach(int phase, float load, float capacity) {
+    long& current = ongoing[phase + 1];
+
+    bool breach = capacity > 0.f && load > capacity;
+
+    if (breach && current < 0) {
+        current = (long) allocEvent();
+        breachCount++;
+        auto& event = events[current % MO_SIM_SITE_EVENTS_MAX];
+        event.phase = phase;
+        event.start = mocpp_tick_ms();
+        event.duration = 0;
+        event.peak = load - capacity;
+        MO_DBG_WARN("site capacity exceeded%s%c: %.0f W > %.0f W",
+                phase >= 0 ? " on L" : "", phase >= 0 ? '1' + phase : ' ', load, capacity);
+    } else if (breach) {
+        auto& event = events[current % MO_SIM_SITE_EVENTS_MAX];
+        if (load - capacity > event.peak) {
+            event.peak = load - capacity;
+        }
+    } else if (current >= 0) {
+        auto& event = events[current % MO_SIM_SITE_EVENTS_MAX];
+        event.duration = mocpp_tick_ms() - event.start;
+        if (event.duration == 0) {
+            event.duration = 1; //0 is reserved for ongoing breaches
+        }
+        MO_DBG_INFO("site load back within capacity after %lu ms", event.duration);
+        current = -1;
+    }
+}
+
+int SiteModel::getCapacity() {
+    return capacityInt ? capacityInt->getInt() : 0;
+}
+
+int SiteModel::getPhaseCapacity() {
+    return phaseCapacityInt ? phaseCapacityInt->getInt() : 0;
+}
+
+void SiteModel::setCapacity(int capacity, int phaseCapacity) {
+    if (!capacityInt || !phaseCapacityInt) {
+        return;
+    }
+    if (capacity == capacityInt->getInt() && phaseCapacity == phaseCapacityInt->getInt()) {
+        return;
+    }
+    capacityInt->setInt(capacity);
+    phaseCapacityInt->setInt(phaseCapacity);
+    MicroOcpp::configuration_save();
+
+    checkBreaches(); //the current load may exceed the new capacity or be back within it
+}
+
+int SiteModel::writeStatusJson(char *buf, size_t size) {
+    int written = snprintf(buf, size,
+            "{\"capacity\":%i,\"phaseCapacity\":%i,\"power\":%.0f,\"phasePower\":[%.0f,%.0f,%.0f],\"peakPower\":%.0f,\"breachCount\":%lu,\"breaches\":[",
+            getCapacity(), getPhaseCapacity(), totalPower, phasePower[0], phasePower[1], phasePower[2], peakPower, breachCount);
+
+    unsigned long first = eventCount > MO_SIM_SITE_EVENTS_MAX ? eventCount - MO_SIM_SITE_EVENTS_MAX : 0;
+    for (unsigned long n = first; n < eventCount; n++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        auto& event = events[n % MO_SIM_SITE_EVENTS_MAX];
+        written += snprintf(buf + written, size - written,
+                "%s{\"phase\":\"%s\",\"ago\":%lu,\"duration\":%lu,\"ongoing\":%s,\"peakExcess\":%.0f}",
+                n > first ? "," : "",
+                event.phase == 0 ? "L1" : event.phase == 1 ? "L2" : event.phase == 2 ? "L3" : "total",
+                mocpp_tick_ms() - event.start,
+                event.duration ? event.duration : mocpp_tick_ms() - event.start,
+                event.duration ? "false" : "true",
+                event.peak);
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "]}");
+    return written;
+}
@@ -0,0 +1,74 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_SITE_H
+#define MO_SIM_SITE_H
+
+#include <array>
+#include <memory>
+#include <MicroOcpp/Core/Configuration.h>
+
+#ifndef MO_SIM_SITE_EVENTS_MAX
+#define MO_SIM_SITE_EVENTS_MAX 16 //number of breach events kept for the API
+#endif
+
+#define MO_SIM_SITE_PHASES 3
+
+static_assert(MO_SIM_SITE_EVENTS_MAX > 1 + MO_SIM_SITE_PHASES, "the event ring must hold more than the ongoing breaches");
+
+/*
+ * Shared grid connection of all connectors. The site doesn't limit the connectors, like a real
+ * feeder it only reports when the aggregate load exceeds its capacity, so that the load management
+ * of the server can be verified. Single-phase loads are distributed over the phases by rotating the
+ * phase per connector (connector 1 on L1, connector 2 on L2, ...). The aggregate is recomputed from
+ * the loads of all connectors on each change, so that float rounding doesn't accumulate over time
+ */
+class SiteModel {
+public:
+    struct BreachEvent {
+        int phase; //-1 for the total capacity, otherwise 0 - 2 for L1 - L3
+        unsigned long start; //mocpp_tick_ms() at the beginning of the breach
+        unsigned long duration; //in ms, 0 while ongoing
+        float peak; //maximum excess in W
+    };
+private:
+    std::shared_ptr<MicroOcpp::Configuration> capacityInt; //in W, 0 for unlimited
+    std::shared_ptr<MicroOcpp::Configuration> phaseCapacityInt; //per phase in W, 0 for unlimited
+
+    std::array<float, MO_NUMCONNECTORS - 1> connectorPower {{}};
+    std::array<int, MO_NUMCONNECTORS - 1> connectorPhases {{}};
+    float totalPower = 0.f;
+    std::array<float, MO_SIM_SITE_PHASES> phasePower {{}};
+    float peakPower = 0.f;
+
+    std::array<BreachEvent, MO_SIM_SITE_EVENTS_MAX> events; //ring buffer, event n at index n % MO_SIM_SITE_EVENTS_MAX
+    unsigned long eventCount = 0; //next event number. Ongoing breaches are renumbered when the ring wraps
+    unsigned long breachCount = 0;
+    long ongoing [1 + MO_SIM_SITE_PHASES] = {-1, -1, -1, -1}; //event number of the ongoing breach of total, L1 - L3
+
+    void recomputeLoad();
+    void checkBreaches();
+    void checkBreach(int phase, float load, float capacity);
+    unsigned long allocEvent();
+public:
+    //declare the site settings. Must be called before loading SIMULATOR_FN
+    void declareConfigurations();
+
+    //reports the current power of a connector. numberPhases: 1 - 3
+    void updatePower(unsigned int connectorId, float power, int numberPhases);
+
+    int getCapacity();
+    int getPhaseCapacity();
+    void setCapacity(int capacity, int phaseCapacity);
+
+    float getTotalPower() {return totalPower;}
+    float getPhasePower(int phase) {return phasePower[phase];}
+    unsigned long getBreachCount() {return breachCount;}
+
+    int writeStatusJson(char *buf, size_t size);
+};
+
+extern SiteModel site;
+
+#endif
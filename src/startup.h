@@ -0,0 +1,20 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_STARTUP_H
+#define MO_SIM_STARTUP_H
+
+/*
+ * Durations of the startup phases in ms, measured from the process start
+ */
+struct SimStartupStats {
+    unsigned long start = 0; //mocpp_tick_ms() at process start
+    unsigned long storageLoaded = 0; //simulator state and journal loaded
+    unsigned long initialized = 0; //MicroOcpp and EVSEs initialized
+    unsigned long bootNotification = 0; //first BootNotification accepted. 0 if pending
+};
+
+extern SimStartupStats startupStats;
+
+#endif
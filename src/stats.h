@@ -0,0 +1,57 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_STATS_H
+#define MO_SIM_STATS_H
+
+#include <MicroOcpp/Platform.h>
+
+/*
+ * Counts events in one-second buckets and reports the average rate over the last
+ * RATE_WINDOW_S completed seconds. Constant memory, no allocations
+ */
+class RateCounter {
+public:
+    static const unsigned long RATE_WINDOW_S = 10;
+private:
+    unsigned long buckets [RATE_WINDOW_S + 1] = {0};
+    unsigned long bucketSecond = 0;
+    unsigned long total = 0;
+
+    void advance(unsigned long nowSecond) {
+        if (nowSecond - bucketSecond > RATE_WINDOW_S) {
+            for (unsigned long i = 0; i <= RATE_WINDOW_S; i++) {
+                buckets[i] = 0;
+            }
+        } else {
+            for (unsigned long s = bucketSecond + 1; s <= nowSecond; s++) {
+                buckets[s % (RATE_WINDOW_S + 1)] = 0;
+            }
+        }
+        bucketSecond = nowSecond;
+    }
+public:
+    void add(unsigned long n = 1) {
+        advance(mocpp_tick_ms() / 1000UL);
+        buckets[bucketSecond % (RATE_WINDOW_S + 1)] += n;
+        total += n;
+    }
+
+    float perSecond() {
+        advance(mocpp_tick_ms() / 1000UL);
+        unsigned long sum = 0;
+        for (unsigned long i = 0; i <= RATE_WINDOW_S; i++) {
+            if (i != bucketSecond % (RATE_WINDOW_S + 1)) { //skip current, incomplete second
+                sum += buckets[i];
+            }
+        }
+        return (float) sum / (float) RATE_WINDOW_S;
+    }
+
+    unsigned long getTotal() {
+        return total;
+    }
+};
+
+#endif
@@ -0,0 +1,207 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "throughput.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <MicroOcpp/Core/Configuration.h>
+#include <MicroOcpp/Core/Context.h>
+#include <MicroOcpp/Model/Variables/VariableService.h>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "evse.h"
+#include "traffic.h"
+
+void TxThroughput::setup(TrafficMeter *traffic) {
+    this->traffic = traffic;
+
+    //the EVSEs outlive the connection, so subscribe only once
+    if (!subscribed) {
+        for (unsigned int i = 0; i < connectors.size(); i++) {
+            connectors[i].addListener([this, i] (Evse&, EvseEvent event) {
+                onEvent(i, event);
+            });
+        }
+        subscribed = true;
+    }
+}
+
+void TxThroughput::onEvent(unsigned int index, EvseEvent event) {
+    if (!running || index >= chargingSince.size()) {
+        return;
+    }
+    auto now = mocpp_tick_ms();
+    if (event == EvseEvent::ChargingStarted && !chargingSince[index]) {
+        chargingSince[index] = now;
+    } else if (event == EvseEvent::ChargingStopped && chargingSince[index]) {
+        generatedDone += 2 + (now - chargingSince[index]) / (interval * 1000UL); //including the tx start and stop
+        chargingSince[index] = 0;
+    }
+}
+
+bool TxThroughput::setInterval(int interval, int *prevOut) {
+    auto context = getOcppContext();
+    if (!context) {
+        return false;
+    }
+
+#if MO_ENABLE_V201
+    if (context->getVersion().major == 2) {
+        auto varService = context->getModel().getVariableService();
+        auto variable = varService ? varService->declareVariable<int>("SampledDataCtrlr", "TxUpdatedInterval", 0) : nullptr;
+        if (!variable) {
+            return false;
+        }
+        if (prevOut) {
+            *prevOut = variable->getInt();
+        }
+        variable->setInt(interval);
+        return true;
+    }
+#endif
+
+    auto config = MicroOcpp::declareConfiguration<int>("MeterValueSampleInterval", 60);
+    if (!config) {
+        return false;
+    }
+    if (prevOut) {
+        *prevOut = config->getInt();
+    }
+    config->setInt(interval);
+    return true;
+}
+
+void TxThroughput::presentIdTag(unsigned int index) {
+    auto& evse = connectors[index];
+#if MO_ENABLE_V201
+    if (getOcppContext()->getVersion().major == 2) {
+        evse.presentNfcTag(idTag.c_str(), "ISO14443");
+        return;
+    }
+#endif
+    evse.presentNfcTag(idTag.c_str());
+}
+
+bool TxThroughput::start(int interval, const char *idTag) {
+    if (running || interval <= 0 || !idTag || !*idTag || !traffic) {
+        return false;
+    }
+
+    if (!setInterval(interval, &prevInterval)) {
+        MO_DBG_ERR("cannot set the meter data interval");
+        return false;
+    }
+
+    this->interval = interval;
+    this->idTag = idTag;
+
+    for (unsigned int i = 0; i < connectors.size(); i++) {
+        auto& evse = connectors[i];
+        evse.setEvPlugged(true);
+        evse.setEvReady(true);
+        evse.setEvseReady(true);
+        if (!evse.isCharging()) {
+            presentIdTag(i);
+        }
+    }
+
+    running = true;
+    since = mocpp_tick_ms();
+    lastSample = since;
+    txMessagesAtStart = traffic->getSentTxMessages();
+    confirmedAtStart = traffic->getConfirmedTxMessages();
+    peakRate = 0.f;
+    peakBacklog = 0;
+    chargingSince.fill(0);
+    generatedDone = 0;
+    for (unsigned int i = 0; i < connectors.size(); i++) {
+        if (connectors[i].isCharging()) {
+            chargingSince[i] = since; //the following charging periods are tracked by onEvent
+        }
+    }
+    MO_DBG_INFO("start tx throughput mode on %zu EVSEs with %i s interval", connectors.size(), interval);
+    return true;
+}
+
+void TxThroughput::stop() {
+    if (!running) {
+        return;
+    }
+    running = false;
+
+    if (prevInterval >= 0) {
+        setInterval(prevInterval, nullptr);
+    }
+
+    for (unsigned int i = 0; i < connectors.size(); i++) {
+        auto& evse = connectors[i];
+        if (evse.isCharging()) {
+            presentIdTag(i); //end the transaction
+        }
+        evse.setEvPlugged(false);
+        evse.setEvReady(false);
+        evse.setEvseReady(false);
+    }
+    MO_DBG_INFO("stop tx throughput mode");
+}
+
+void TxThroughput::loop() {
+    if (!running) {
+        return;
+    }
+
+    auto now = mocpp_tick_ms();
+    if (now - lastSample < 1000) {
+        return;
+    }
+    lastSample = now;
+
+    float rate = traffic->getSentTxMessagesPerSecond();
+    if (rate > peakRate) {
+        peakRate = rate;
+    }
+    peakBacklog = std::max(peakBacklog, getBacklog());
+}
+
+unsigned long TxThroughput::getGenerated() {
+    unsigned long generated = generatedDone;
+    auto now = mocpp_tick_ms();
+    for (unsigned int i = 0; i < connectors.size(); i++) {
+        if (chargingSince[i]) {
+            generated += 1 + (now - chargingSince[i]) / (interval * 1000UL);
+        }
+    }
+    return generated;
+}
+
+unsigned long TxThroughput::getBacklog() {
+    if (!traffic) {
+        return 0;
+    }
+    unsigned long confirmed = traffic->getConfirmedTxMessages() - confirmedAtStart;
+    unsigned long generated = getGenerated();
+    return generated > confirmed ? generated - confirmed : 0;
+}
+
+int TxThroughput::writeStatusJson(char *buf, size_t size) {
+    unsigned long charging = 0;
+    for (auto& evse : connectors) {
+        if (evse.isCharging()) {
+            charging++;
+        }
+    }
+
+    unsigned long duration = running ? mocpp_tick_ms() - since : 0;
+    unsigned long txMessages = traffic ? traffic->getSentTxMessages() - txMessagesAtStart : 0;
+
+    return snprintf(buf, size,
+            "{\"running\":%s,\"interval\":%i,\"evses\":%zu,\"charging\":%lu,\"duration\":%lu,\"txMessages\":%lu,"
+            "\"perSecond\":%.1f,\"avgPerSecond\":%.1f,\"peakPerSecond\":%.1f,\"txBacklog\":%lu,\"peakTxBacklog\":%lu}",
+            running ? "true" : "false", interval, connectors.size(), charging, duration, txMessages,
+            traffic ? traffic->getSentTxMessagesPerSecond() : 0.f,
+            duration ? 1000. * (double) txMessages / (double) duration : 0.,
+            peakRate, running ? getBacklog() : 0UL, peakBacklog);
+}
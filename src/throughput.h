@@ -0,0 +1,65 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_THROUGHPUT_H
+#define MO_SIM_THROUGHPUT_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+class TrafficMeter;
+enum class EvseEvent;
+
+/*
+ * Transaction throughput mode: starts a transaction on every EVSE and shortens the meter data
+ * interval (TxUpdatedInterval in OCPP 2.0.1, MeterValueSampleInterval in 1.6), so that the charger
+ * emits a steady stream of TransactionEvent Updated / MeterValues messages. Reports the tx-related
+ * messages per second and the backlog of tx messages which the server hasn't confirmed yet. MicroOcpp
+ * doesn't expose its send queue, so the backlog is derived from the generated messages: each EVSE
+ * emits one message at the tx start and one per interval while charging
+ */
+class TxThroughput {
+private:
+    TrafficMeter *traffic = nullptr;
+
+    bool running = false;
+    int interval = 0; //in s
+    int prevInterval = -1; //restored on stop
+    std::string idTag;
+
+    unsigned long since = 0;
+    unsigned long txMessagesAtStart = 0;
+    unsigned long confirmedAtStart = 0;
+    float peakRate = 0.f;
+    unsigned long peakBacklog = 0;
+    unsigned long lastSample = 0;
+
+    std::array<unsigned long, MO_NUMCONNECTORS - 1> chargingSince {{}}; //0 while not charging
+    unsigned long generatedDone = 0; //tx messages of the charging periods which have ended
+
+    bool subscribed = false;
+    void onEvent(unsigned int index, EvseEvent event);
+
+    unsigned long getGenerated();
+    unsigned long getBacklog();
+
+    bool setInterval(int interval, int *prevOut);
+    void presentIdTag(unsigned int index);
+public:
+    void setup(TrafficMeter *traffic);
+
+    bool start(int interval, const char *idTag);
+    void stop();
+
+    void loop();
+
+    bool isRunning() {return running;}
+
+    int writeStatusJson(char *buf, size_t size);
+};
+
+extern TxThroughput txThroughput;
+
+#endif
@@ -0,0 +1,448 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "tokens.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <MicroOcpp/Core/Context.h>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include "evse.h"
+
+namespace {
+
+uint64_t mix64(uint64_t x) {
+    //splitmix64 finalizer
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+} //namespace
+
+bool TokenDistribution::parse(const char *cstr, size_t len) {
+    char buf [64];
+    if (len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, cstr, len);
+    buf[len] = '\0';
+
+    char *sep = strchr(buf, ':');
+    if (!sep) {
+        return false;
+    }
+    *sep = '\0';
+    const char *params = sep + 1;
+
+    float a = 0.f, b = 0.f;
+    char *end = nullptr;
+    a = strtof(params, &end);
+    if (end == params) {
+        return false;
+    }
+    bool hasB = *end == ':';
+    if (hasB) {
+        const char *paramB = end + 1;
+        b = strtof(paramB, &end);
+        if (end == paramB) {
+            return false;
+        }
+    }
+    if (*end != '\0' || a < 0.f || b < 0.f) {
+        return false;
+    }
+
+    if (!strcmp(buf, "fixed") && !hasB) {
+        kind = Kind::Fixed;
+    } else if (!strcmp(buf, "uniform") && hasB && b >= a) {
+        kind = Kind::Uniform;
+    } else if (!strcmp(buf, "exp") && !hasB) {
+        kind = Kind::Exponential;
+    } else if (!strcmp(buf, "lognormal") && hasB && a > 0.f) {
+        kind = Kind::LogNormal;
+    } else {
+        return false;
+    }
+    this->a = a;
+    this->b = b;
+    return true;
+}
+
+int TokenDistribution::writeJson(char *buf, size_t size) {
+    switch (kind) {
+        case Kind::Fixed:
+            return snprintf(buf, size, "\"fixed:%g\"", a);
+        case Kind::Uniform:
+            return snprintf(buf, size, "\"uniform:%g:%g\"", a, b);
+        case Kind::Exponential:
+            return snprintf(buf, size, "\"exp:%g\"", a);
+        case Kind::LogNormal:
+            return snprintf(buf, size, "\"lognormal:%g:%g\"", a, b);
+    }
+    return -1;
+}
+
+TokenPopulation::Config::Config() {
+    arrival.kind = TokenDistribution::Kind::Exponential;
+    arrival.a = 60.f;
+    duration.kind = TokenDistribution::Kind::LogNormal;
+    duration.a = 1800.f;
+    duration.b = 900.f;
+    energy.kind = TokenDistribution::Kind::Fixed;
+    energy.a = 0.f;
+}
+
+const char *cstrFromTokenClass(TokenPopulation::TokenClass tokenClass) {
+    switch (tokenClass) {
+        case TokenPopulation::TokenClass::Valid:
+            return "Valid";
+        case TokenPopulation::TokenClass::Invalid:
+            return "Invalid";
+        case TokenPopulation::TokenClass::Blocked:
+            return "Blocked";
+        case TokenPopulation::TokenClass::Expired:
+            return "Expired";
+    }
+    return "";
+}
+
+uint32_t TokenPopulation::random() {
+    //xorshift32
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+float TokenPopulation::uniform() {
+    return (float) (random() >> 8) * (1.f / 16777216.f); //[0, 1)
+}
+
+float TokenPopulation::sample(const TokenDistribution& dist) {
+    switch (dist.kind) {
+        case TokenDistribution::Kind::Fixed:
+            return dist.a;
+        case TokenDistribution::Kind::Uniform:
+            return dist.a + (dist.b - dist.a) * uniform();
+        case TokenDistribution::Kind::Exponential:
+            return -dist.a * std::log(1.f - uniform());
+        case TokenDistribution::Kind::LogNormal: {
+            //parameters of the underlying normal distribution from mean and standard deviation
+            float sigma2 = std::log(1.f + (dist.b * dist.b) / (dist.a * dist.a));
+            float mu = std::log(dist.a) - 0.5f * sigma2;
+            //Box-Muller
+            float n = std::sqrt(-2.f * std::log(1.f - uniform())) * std::cos(6.2831853f * uniform());
+            return std::exp(mu + std::sqrt(sigma2) * n);
+        }
+    }
+    return 0.f;
+}
+
+bool TokenPopulation::start(const Config& config) {
+    uint64_t population = (uint64_t) config.rfid + (uint64_t) config.emaid;
+    if (population == 0 || population > MO_SIM_TOKENS_MAX ||
+            config.zipf < 0.f || config.invalid < 0.f || config.blocked < 0.f || config.expired < 0.f ||
+            config.invalid + config.blocked + config.expired > 1.f) {
+        MO_DBG_ERR("invalid token population");
+        return false;
+    }
+
+    stop();
+
+    this->config = config;
+    this->population = (uint32_t) population;
+    rng = config.seed ? (uint32_t) config.seed : 1U;
+
+    //token at popularity rank k has weight 1 / (k+1)^s
+    cdf.resize(this->population);
+    double sum = 0.;
+    for (uint32_t k = 0; k < this->population; k++) {
+        sum += config.zipf > 0.f ? std::pow((double) (k + 1), -(double) config.zipf) : 1.;
+        cdf[k] = sum;
+    }
+
+    //spread the popular ranks over the token indices, so that popularity doesn't correlate with the token type
+    stride = (uint32_t) (2654435761ULL % this->population);
+    while (gcd(stride, this->population) != 1) {
+        stride++;
+    }
+
+    seen.assign(this->population, false);
+
+    sessionsStarted = 0;
+    sessionsCompleted = 0;
+    unique = 0;
+    repeats = 0;
+    energyDelivered = 0;
+    presented = {{}};
+    accepted = {{}};
+    rejected = {{}};
+
+    auto now = mocpp_tick_ms();
+    for (auto& session : sessions) {
+        session = Session();
+        session.nextArrival = now + (unsigned long) (1000.f * sample(config.arrival));
+    }
+
+    running = true;
+    MO_DBG_INFO("start token population with %u tokens", this->population);
+    return true;
+}
+
+void TokenPopulation::stop() {
+    if (!running) {
+        return;
+    }
+    for (unsigned int i = 0; i < sessions.size(); i++) {
+        if (sessions[i].state != SessionState::Idle) {
+            endSession(i, true);
+        }
+    }
+    running = false;
+    MO_DBG_INFO("stop token population");
+}
+
+void TokenPopulation::rearm() {
+    if (!running) {
+        return;
+    }
+    //MicroOcpp is about to be deinitialized, so only unplug the EVs. The transactions end with the reboot
+    auto now = mocpp_tick_ms();
+    for (unsigned int i = 0; i < sessions.size() && i < connectors.size(); i++) {
+        auto& session = sessions[i];
+        if (session.state != SessionState::Idle) {
+            auto& evse = connectors[i];
+            evse.setEvPlugged(false);
+            evse.setEvReady(false);
+            evse.setEvseReady(false);
+        }
+        session = Session();
+        session.nextArrival = now + (unsigned long) (1000.f * sample(config.arrival));
+    }
+    MO_DBG_INFO("token population re-armed after reset");
+}
+
+bool TokenPopulation::isEmaid(uint32_t index) {
+    return index >= config.rfid;
+}
+
+TokenPopulation::TokenClass TokenPopulation::getClass(uint32_t index) {
+    float r = (float) (mix64(((uint64_t) config.seed << 32) | index) % 1000000ULL) * 1e-6f;
+    if (r < config.invalid) {
+        return TokenClass::Invalid;
+    } else if (r < config.invalid + config.blocked) {
+        return TokenClass::Blocked;
+    } else if (r < config.invalid + config.blocked + config.expired) {
+        return TokenClass::Expired;
+    }
+    return TokenClass::Valid;
+}
+
+int TokenPopulation::writeTokenId(uint32_t index, char *buf, size_t size) {
+    if (isEmaid(index)) {
+        return snprintf(buf, size, "DESIM%09u", index - config.rfid);
+    }
+    //7-byte UID like on MIFARE cards
+    return snprintf(buf, size, "%014llX", (unsigned long long) (mix64(((uint64_t) config.seed << 32) ^ ~(uint64_t) index) & 0xFFFFFFFFFFFFFFULL));
+}
+
+uint32_t TokenPopulation::drawToken() {
+    double u = (double) uniform() * cdf.back();
+    size_t rank = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    if (rank >= cdf.size()) {
+        rank = cdf.size() - 1;
+    }
+    return (uint32_t) (((uint64_t) rank * stride) % population);
+}
+
+void TokenPopulation::endSession(unsigned int index, bool unplug) {
+    auto& session = sessions[index];
+    auto& evse = connectors[index];
+
+    if (*evse.getSessionIdTag() || evse.isCharging()) {
+        //present the token again to end the transaction like a driver
+        char idTag [32];
+        writeTokenId(session.token, idTag, sizeof(idTag));
+#if MO_ENABLE_V201
+        if (getOcppContext()->getVersion().major == 2) {
+            evse.presentNfcTag(idTag, isEmaid(session.token) ? "eMAID" : "ISO14443");
+        } else
+#endif
+        {
+            evse.presentNfcTag(idTag);
+        }
+    }
+
+    if (unplug) {
+        evse.setEvPlugged(false);
+        evse.setEvReady(false);
+        evse.setEvseReady(false);
+    }
+
+    session.state = SessionState::Idle;
+    session.nextArrival = mocpp_tick_ms() + (unsigned long) (1000.f * sample(config.arrival));
+}
+
+void TokenPopulation::loop() {
+    if (!running) {
+        return;
+    }
+
+    auto now = mocpp_tick_ms();
+
+    for (unsigned int i = 0; i < sessions.size() && i < connectors.size(); i++) {
+        auto& session = sessions[i];
+        auto& evse = connectors[i];
+
+        switch (session.state) {
+            case SessionState::Idle: {
+                if ((long) (now - session.nextArrival) < 0) {
+                    break;
+                }
+                if (evse.getEvPlugged() || *evse.getSessionIdTag()) {
+                    //connector is used by someone else, try again later
+                    session.nextArrival = now + (unsigned long) (1000.f * sample(config.arrival));
+                    break;
+                }
+
+                session.token = drawToken();
+                auto tokenClass = getClass(session.token);
+                presented[(size_t) tokenClass]++;
+                if (seen[session.token]) {
+                    repeats++;
+                } else {
+                    seen[session.token] = true;
+                    unique++;
+                }
+                sessionsStarted++;
+
+                evse.setEvPlugged(true);
+                evse.setEvReady(true);
+                evse.setEvseReady(true);
+
+                char idTag [32];
+                writeTokenId(session.token, idTag, sizeof(idTag));
+#if MO_ENABLE_V201
+                if (getOcppContext()->getVersion().major == 2) {
+                    evse.presentNfcTag(idTag, isEmaid(session.token) ? "eMAID" : "ISO14443");
+                } else
+#endif
+                {
+                    evse.presentNfcTag(idTag);
+                }
+
+                session.state = SessionState::Authorizing;
+                session.since = now;
+                break;
+            }
+            case SessionState::Authorizing:
+                if (evse.isCharging()) {
+                    accepted[(size_t) getClass(session.token)]++;
+                    session.state = SessionState::Charging;
+                    session.since = now;
+                    session.duration = (unsigned long) (1000.f * sample(config.duration));
+                    session.energyTarget = (int) sample(config.energy);
+                    session.energyStart = evse.getEnergy();
+                } else if (now - session.since >= MO_SIM_TOKENS_AUTH_TIMEOUT) {
+                    rejected[(size_t) getClass(session.token)]++;
+                    endSession(i, true);
+                }
+                break;
+            case SessionState::Charging: {
+                int delivered = evse.getEnergy() - session.energyStart;
+                if (now - session.since >= session.duration ||
+                        (session.energyTarget > 0 && delivered >= session.energyTarget) ||
+                        (!evse.isCharging() && !*evse.getSessionIdTag())) { //ended by the CSMS
+                    energyDelivered += (uint64_t) std::max(0, delivered);
+                    sessionsCompleted++;
+                    endSession(i, true);
+                }
+                break;
+            }
+        }
+    }
+}
+
+int TokenPopulation::writeStatusJson(char *buf, size_t size) {
+    int written = snprintf(buf, size,
+            "{\"running\":%s,\"rfid\":%u,\"emaid\":%u,\"zipf\":%g,\"invalid\":%g,\"blocked\":%g,\"expired\":%g,\"seed\":%lu,\"arrival\":",
+            running ? "true" : "false", config.rfid, config.emaid, config.zipf,
+            config.invalid, config.blocked, config.expired, (unsigned long) config.seed);
+
+    const char *keys [] = {",\"duration\":", ",\"energy\":"};
+    TokenDistribution *dists [] = {&config.arrival, &config.duration, &config.energy};
+    for (size_t i = 0; i < 3; i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        if (i > 0) {
+            written += snprintf(buf + written, size - written, "%s", keys[i - 1]);
+            if (written < 0 || (size_t) written >= size) {
+                return -1;
+            }
+        }
+        int ret = dists[i]->writeJson(buf + written, size - written);
+        if (ret < 0) {
+            return -1;
+        }
+        written += ret;
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    unsigned long draws = unique + repeats;
+    written += snprintf(buf + written, size - written,
+            ",\"sessionsStarted\":%lu,\"sessionsCompleted\":%lu,\"energyDelivered\":%llu,\"uniqueTokens\":%lu,\"repeatedTokens\":%lu,\"repeatRatio\":%.3f,\"classes\":{",
+            sessionsStarted, sessionsCompleted, (unsigned long long) energyDelivered, unique, repeats,
+            draws ? (double) repeats / (double) draws : 0.);
+
+    for (size_t i = 0; i < NUM_CLASSES; i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        written += snprintf(buf + written, size - written, "%s\"%s\":{\"presented\":%lu,\"accepted\":%lu,\"rejected\":%lu}",
+                i ? "," : "", cstrFromTokenClass((TokenClass) i), presented[i], accepted[i], rejected[i]);
+    }
+
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "}}");
+    return written;
+}
+
+int TokenPopulation::writeListJson(char *buf, size_t size, uint32_t offset, uint32_t limit) {
+    int written = snprintf(buf, size, "{\"population\":%u,\"offset\":%u,\"tokens\":[", population, offset);
+    for (uint32_t i = offset; i < population && i - offset < limit; i++) {
+        if (written < 0 || (size_t) written >= size) {
+            return -1;
+        }
+        char idTag [32];
+        writeTokenId(i, idTag, sizeof(idTag));
+        written += snprintf(buf + written, size - written, "%s{\"idTag\":\"%s\",\"type\":\"%s\",\"class\":\"%s\"}",
+                i > offset ? "," : "", idTag, isEmaid(i) ? "eMAID" : "ISO14443", cstrFromTokenClass(getClass(i)));
+    }
+    if (written < 0 || (size_t) written >= size) {
+        return -1;
+    }
+    written += snprintf(buf + written, size - written, "]}");
+    return written;
+}
@@ -0,0 +1,137 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_TOKENS_H
+#define MO_SIM_TOKENS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef MO_SIM_TOKENS_MAX
+#define MO_SIM_TOKENS_MAX 1000000 //maximum population size
+#endif
+
+#ifndef MO_SIM_TOKENS_AUTH_TIMEOUT
+#define MO_SIM_TOKENS_AUTH_TIMEOUT 30000 //a token which doesn't start charging within this period in ms counts as rejected
+#endif
+
+/*
+ * Random distribution for the token generator, parsed from "fixed:<a>", "uniform:<min>:<max>",
+ * "exp:<mean>" or "lognormal:<mean>:<stddev>"
+ */
+struct TokenDistribution {
+    enum class Kind {
+        Fixed,
+        Uniform,
+        Exponential,
+        LogNormal
+    };
+    Kind kind = Kind::Fixed;
+    float a = 0.f;
+    float b = 0.f;
+
+    bool parse(const char *cstr, size_t len);
+    int writeJson(char *buf, size_t size);
+};
+
+/*
+ * Token population generator. Creates a fleet of RFID and eMAID tokens with a share of invalid,
+ * blocked and expired tokens and drives charging sessions on the idle connectors: a token is
+ * drawn from a Zipf distribution, so a few tokens are reused often like in a real fleet. The
+ * sessions end after a random duration or energy. The token ids and classes are deterministic
+ * for a seed, so the CSMS can be provisioned with the list from /tokens/list beforehand
+ */
+class TokenPopulation {
+public:
+    enum class TokenClass {
+        Valid,
+        Invalid, //unknown to the CSMS
+        Blocked,
+        Expired
+    };
+    static const size_t NUM_CLASSES = 4;
+
+    struct Config {
+        unsigned int rfid = 1000;
+        unsigned int emaid = 0;
+        float zipf = 1.f; //exponent of the Zipf distribution, 0 for uniform reuse
+        float invalid = 0.f;
+        float blocked = 0.f;
+        float expired = 0.f;
+        unsigned int seed = 1;
+        TokenDistribution arrival; //idle time of a connector between sessions in s
+        TokenDistribution duration; //session duration in s
+        TokenDistribution energy; //energy demand of a session in Wh, 0 for unlimited
+
+        Config();
+    };
+private:
+    enum class SessionState {
+        Idle,
+        Authorizing,
+        Charging
+    };
+    struct Session {
+        SessionState state = SessionState::Idle;
+        unsigned long since = 0;
+        unsigned long nextArrival = 0;
+        unsigned long duration = 0; //in ms
+        int energyTarget = 0;
+        int energyStart = 0;
+        uint32_t token = 0;
+    };
+    std::array<Session, MO_NUMCONNECTORS - 1> sessions;
+
+    Config config;
+    bool running = false;
+    uint32_t population = 0;
+    std::vector<double> cdf; //cumulative Zipf weights by popularity rank
+    uint32_t stride = 1; //maps popularity ranks to token indices
+    std::vector<bool> seen;
+
+    uint32_t rng = 2463534242U;
+    uint32_t random();
+    float uniform();
+    float sample(const TokenDistribution& dist);
+
+    uint32_t drawToken();
+    void endSession(unsigned int index, bool unplug);
+
+    unsigned long sessionsStarted = 0;
+    unsigned long sessionsCompleted = 0;
+    unsigned long unique = 0;
+    unsigned long repeats = 0;
+    uint64_t energyDelivered = 0;
+    std::array<unsigned long, NUM_CLASSES> presented {{}};
+    std::array<unsigned long, NUM_CLASSES> accepted {{}};
+    std::array<unsigned long, NUM_CLASSES> rejected {{}};
+public:
+    bool start(const Config& config);
+    void stop();
+
+    //the charger reboots: drops the sessions in progress and schedules new arrivals after the reboot
+    void rearm();
+
+    void loop();
+
+    bool isRunning() {return running;}
+
+    //token properties, for index < population size
+    bool isEmaid(uint32_t index);
+    TokenClass getClass(uint32_t index);
+    int writeTokenId(uint32_t index, char *buf, size_t size);
+
+    int writeStatusJson(char *buf, size_t size);
+
+    //token ids and classes for provisioning the CSMS
+    int writeListJson(char *buf, size_t size, uint32_t offset, uint32_t limit);
+};
+
+const char *cstrFromTokenClass(TokenPopulation::TokenClass tokenClass);
+
+extern TokenPopulation tokenPopulation;
+
+#endif
@@ -0,0 +1,167 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#include "traffic.h"
+
+#include <cstring>
+#include <algorithm>
+#include <initializer_list>
+#include <MicroOcpp/Platform.h>
+
+#define OCPP_MSG_CALL 2
+#define OCPP_MSG_CALLRESULT 3
+#define OCPP_MSG_CALLERROR 4
+
+//returns the OCPP-J message type id of a serialized message, i.e. the first element of the JSON array
+int ocppMessageTypeId(const char *msg, size_t length) {
+    size_t i = 0;
+    while (i < length && (msg[i] == ' ' || msg[i] == '\t' || msg[i] == '\r' || msg[i] == '\n' || msg[i] == '[')) {
+        i++;
+    }
+    if (i >= length || msg[i] < '0' || msg[i] > '9') {
+        return -1;
+    }
+    return msg[i] - '0';
+}
+
+//checks if a CALL belongs to a transaction, i.e. if its action (the third element) is one of the tx-related messages
+bool isTxMessage(const char *msg, size_t length) {
+    //skip the opening quotes and the message id
+    size_t quotes = 0, i = 0;
+    for (; i < length && quotes < 3; i++) {
+        if (msg[i] == '"') {
+            quotes++;
+        }
+    }
+    if (quotes < 3) {
+        return false;
+    }
+    const char *action = msg + i;
+    size_t len = 0;
+    while (i + len < length && action[len] != '"') {
+        len++;
+    }
+    for (const char *txAction : {"TransactionEvent", "StartTransaction", "StopTransaction", "MeterValues"}) {
+        if (len == strlen(txAction) && !strncmp(action, txAction, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//returns the message id of a serialized message, i.e. the second element of the JSON array
+bool ocppMessageId(const char *msg, size_t length, const char *& idOut, size_t& lenOut) {
+    const char *begin = (const char*) memchr(msg, '"', length);
+    if (!begin) {
+        return false;
+    }
+    begin++;
+    const char *end = (const char*) memchr(begin, '"', length - (begin - msg));
+    if (!end) {
+        return false;
+    }
+    idOut = begin;
+    lenOut = end - begin;
+    return true;
+}
+
+TrafficMeter::TrafficMeter(MicroOcpp::Connection& connection) : connection(connection) {
+    receiveTXTwrapper = [this] (const char *msg, size_t length) -> bool {
+        count(msg, length, false);
+        return receiveTXT ? receiveTXT(msg, length) : false;
+    };
+}
+
+void TrafficMeter::count(const char *msg, size_t length, bool outgoing) {
+    int typeId = ocppMessageTypeId(msg, length);
+    const char *msgId = nullptr;
+    size_t msgIdLen = 0;
+    if (outgoing) {
+        sentBytes += length;
+        if (typeId == OCPP_MSG_CALL) {
+            sentCalls.add();
+            bool tx = isTxMessage(msg, length);
+            if (tx) {
+                sentTxMessages.add();
+            }
+            if (ocppMessageId(msg, length, msgId, msgIdLen)) {
+                std::string id (msgId, msgIdLen);
+                //MicroOcpp retries with the same message id
+                auto it = std::find_if(pendingCalls.begin(), pendingCalls.end(), [&id] (const PendingCall& call) {return call.msgId == id;});
+                if (it != pendingCalls.end()) {
+                    it->sent = mocpp_tick_ms();
+                } else {
+                    pendingCalls.push_back({std::move(id), mocpp_tick_ms(), tx});
+                }
+            }
+        } else if (typeId == OCPP_MSG_CALLRESULT || typeId == OCPP_MSG_CALLERROR) {
+            sentResults.add();
+        }
+    } else {
+        recvBytes += length;
+        if (typeId == OCPP_MSG_CALL) {
+            recvCalls.add();
+        } else if (typeId == OCPP_MSG_CALLRESULT || typeId == OCPP_MSG_CALLERROR) {
+            recvResults.add();
+            if (ocppMessageId(msg, length, msgId, msgIdLen)) {
+                auto it = std::find_if(pendingCalls.begin(), pendingCalls.end(), [msgId, msgIdLen] (const PendingCall& call) {
+                        return call.msgId.size() == msgIdLen && !strncmp(call.msgId.c_str(), msgId, msgIdLen);
+                    });
+                if (it != pendingCalls.end()) {
+                    if (it->tx) {
+                        confirmedTxMessages++;
+                    }
+                    pendingCalls.erase(it);
+                }
+            }
+        }
+    }
+}
+
+void TrafficMeter::loop() {
+    connection.loop();
+
+    if (connection.getLastConnected() != lastConnected) {
+        //new connection, the responses to the requests of the previous one won't arrive anymore
+        lastConnected = connection.getLastConnected();
+        lostCalls += pendingCalls.size();
+        pendingCalls.clear();
+    }
+
+    auto now = mocpp_tick_ms();
+    auto expired = std::remove_if(pendingCalls.begin(), pendingCalls.end(), [now] (const PendingCall& call) {
+            return now - call.sent >= MO_SIM_TRAFFIC_CALL_TIMEOUT;
+        });
+    lostCalls += pendingCalls.end() - expired;
+    pendingCalls.erase(expired, pendingCalls.end());
+}
+
+unsigned long TrafficMeter::getPendingTxCalls() {
+    return std::count_if(pendingCalls.begin(), pendingCalls.end(), [] (const PendingCall& call) {return call.tx;});
+}
+
+bool TrafficMeter::sendTXT(const char *msg, size_t length) {
+    if (stalled) {
+        return false;
+    }
+    if (!connection.sendTXT(msg, length)) {
+        sendFailures++;
+        return false;
+    }
+    count(msg, length, true);
+    return true;
+}
+
+void TrafficMeter::setReceiveTXTcallback(MicroOcpp::ReceiveTXTcallback &receiveTXT) {
+    this->receiveTXT = receiveTXT;
+    connection.setReceiveTXTcallback(receiveTXTwrapper);
+}
+
+unsigned long TrafficMeter::getLastRecv() {
+    return connection.getLastRecv();
+}
+
+unsigned long TrafficMeter::getLastConnected() {
+    return connection.getLastConnected();
+}
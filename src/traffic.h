@@ -0,0 +1,81 @@
+// matth-x/MicroOcppSimulator
+// Copyright Matthias Akstaller 2022 - 2024
+// GPL-3.0 License
+
+#ifndef MO_SIM_TRAFFIC_H
+#define MO_SIM_TRAFFIC_H
+
+#include <string>
+#include <vector>
+#include <MicroOcpp/Core/Connection.h>
+
+#include "stats.h"
+
+#ifndef MO_SIM_TRAFFIC_CALL_TIMEOUT
+#define MO_SIM_TRAFFIC_CALL_TIMEOUT 60000 //a request without response after this period in ms counts as lost. MicroOcpp has given up on it by then
+#endif
+
+/*
+ * Connection decorator which counts the OCPP messages between MicroOcpp and the WebSocket. The
+ * message ids of sent requests are tracked until the response arrives, the request times out or
+ * the connection is established anew, so that the pending count doesn't accumulate lost responses
+ */
+class TrafficMeter : public MicroOcpp::Connection {
+private:
+    MicroOcpp::Connection& connection;
+    MicroOcpp::ReceiveTXTcallback receiveTXT;
+    MicroOcpp::ReceiveTXTcallback receiveTXTwrapper;
+
+    RateCounter sentCalls, sentResults, recvCalls, recvResults;
+    RateCounter sentTxMessages; //TransactionEvent, or Start-/StopTransaction and MeterValues in OCPP 1.6
+    unsigned long sentBytes = 0, recvBytes = 0;
+    unsigned long sendFailures = 0;
+    bool stalled = false;
+
+    struct PendingCall {
+        std::string msgId;
+        unsigned long sent; //mocpp_tick_ms()
+        bool tx; //tx-related message
+    };
+    std::vector<PendingCall> pendingCalls;
+    unsigned long lostCalls = 0; //timed out or dropped with the connection
+    unsigned long confirmedTxMessages = 0;
+    unsigned long lastConnected = 0;
+
+    void count(const char *msg, size_t length, bool outgoing);
+public:
+    TrafficMeter(MicroOcpp::Connection& connection);
+
+    void loop() override;
+
+    bool sendTXT(const char *msg, size_t length) override;
+
+    void setReceiveTXTcallback(MicroOcpp::ReceiveTXTcallback &receiveTXT) override;
+
+    unsigned long getLastRecv() override;
+
+    unsigned long getLastConnected() override;
+
+    unsigned long getSentCalls() {return sentCalls.getTotal();}
+    float getSentCallsPerSecond() {return sentCalls.perSecond();}
+    unsigned long getRecvCalls() {return recvCalls.getTotal();}
+    unsigned long getSentBytes() {return sentBytes;}
+    unsigned long getRecvBytes() {return recvBytes;}
+    unsigned long getSendFailures() {return sendFailures;}
+    unsigned long getSentTxMessages() {return sentTxMessages.getTotal();}
+    float getSentTxMessagesPerSecond() {return sentTxMessages.perSecond();}
+    unsigned long getConfirmedTxMessages() {return confirmedTxMessages;}
+
+    //while stalled, outgoing messages are refused and retried by MicroOcpp later
+    void setStalled(bool stalled) {this->stalled = stalled;}
+    bool isStalled() {return stalled;}
+
+    //number of requests sent on the current connection which the server hasn't confirmed yet
+    unsigned long getPendingCalls() {return pendingCalls.size();}
+    unsigned long getPendingTxCalls();
+    unsigned long getLostCalls() {return lostCalls;}
+};
+
+extern TrafficMeter *traffic;
+
+#endif